@@ -22,19 +22,66 @@ Config::Config(){
     //数据库连接池数量,默认8
     sql_num = 5;
 
-    //线程池内的线程数量,默认8
-    thread_num = 5;
+    //线程池内的最小线程数量,默认为可用的CPU数
+    thread_num = 0;
+
+    //线程池内的最大线程数量,默认为最小数量的4倍
+    thread_max = 0;
       
     //关闭日志,默认不关闭
     close_log = 0;
 
-    //并发模型,默认是proactor
+    //并发模型,默认是proactor: 0 模拟proactor, 1 reactor, 2 io_uring proactor
     actor_model = 0;
+
+    //事件循环数量,默认1个,即单reactor
+    reactor_num = 1;
+
+    //监听队列长度,默认1024,实际受net.core.somaxconn限制
+    backlog = 1024;
+
+    //每次唤醒最多接收的连接数,默认64
+    accept_budget = 64;
+
+    //TCP_DEFER_ACCEPT,默认不开启
+    defer_accept = 0;
+
+    //TCP_FASTOPEN,默认不开启
+    fastopen = 0;
+
+    //静态文件发送方式,默认0: 0 mmap+writev, 1 sendfile(io_uring模式下固定为0)
+    send_mode = 0;
+
+    //请求行和请求头的最大字节数,默认8KB,超过返回431
+    header_limit = 8192;
+
+    //消息体的最大字节数,默认1MB,超过返回413
+    body_limit = 1048576;
+
+    //长连接空闲超时,默认15秒
+    keepalive_timeout = 15;
+
+    //每个连接最多处理的请求数,默认不限制
+    max_requests = 0;
+
+    //开始关闭空闲长连接的连接数,默认为最大连接数的90%
+    idle_high_water = 0;
+
+    //接收请求头、接收消息体和发送响应的超时,默认各15秒
+    header_timeout = 15;
+    body_timeout = 15;
+    write_timeout = 15;
+
+    //消息体的最低接收速率,默认1KB/s
+    body_rate = 1024;
+
+    //线程池调度方式,默认所有工作线程共用一个队列
+    sched = 0;
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:c:a:r:b:n:d:f:w:H:B:k:q:e:i:j:u:g:y:x:";
     while ((opt = getopt(argc, argv, str)) != -1) {
         switch (opt) {
             case 'p':
@@ -77,6 +124,91 @@ void Config::parse_arg(int argc, char*argv[]){
                 actor_model = atoi(optarg);
                 break;
             }
+            case 'r':
+            {
+                reactor_num = atoi(optarg);
+                break;
+            }
+            case 'b':
+            {
+                backlog = atoi(optarg);
+                break;
+            }
+            case 'n':
+            {
+                accept_budget = atoi(optarg);
+                break;
+            }
+            case 'd':
+            {
+                defer_accept = atoi(optarg);
+                break;
+            }
+            case 'f':
+            {
+                fastopen = atoi(optarg);
+                break;
+            }
+            case 'w':
+            {
+                send_mode = atoi(optarg);
+                break;
+            }
+            case 'H':
+            {
+                header_limit = atoi(optarg);
+                break;
+            }
+            case 'B':
+            {
+                body_limit = atoi(optarg);
+                break;
+            }
+            case 'k':
+            {
+                keepalive_timeout = atoi(optarg);
+                break;
+            }
+            case 'q':
+            {
+                max_requests = atoi(optarg);
+                break;
+            }
+            case 'e':
+            {
+                idle_high_water = atoi(optarg);
+                break;
+            }
+            case 'i':
+            {
+                header_timeout = atoi(optarg);
+                break;
+            }
+            case 'j':
+            {
+                body_timeout = atoi(optarg);
+                break;
+            }
+            case 'u':
+            {
+                body_rate = atoi(optarg);
+                break;
+            }
+            case 'g':
+            {
+                write_timeout = atoi(optarg);
+                break;
+            }
+            case 'y':
+            {
+                sched = atoi(optarg);
+                break;
+            }
+            case 'x':
+            {
+                thread_max = atoi(optarg);
+                break;
+            }
             default:
                 break;
         }
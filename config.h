@@ -32,14 +32,59 @@ public:
     //数据库连接池数量
     int sql_num;
 
-    //线程池内的线程数量
+    //线程池内的最小、最大线程数量，0为按可用的CPU数确定
     int thread_num;
+    int thread_max;
 
     //是否关闭日志
     int close_log;
 
     //并发模型选择
     int actor_model;
+
+    //reactor(事件循环)数量
+    int reactor_num;
+
+    //监听队列长度
+    int backlog;
+
+    //每次唤醒最多接收的连接数
+    int accept_budget;
+
+    //TCP_DEFER_ACCEPT秒数，0为不开启
+    int defer_accept;
+
+    //TCP_FASTOPEN队列长度，0为不开启
+    int fastopen;
+
+    //静态文件发送方式
+    int send_mode;
+
+    //请求行和请求头的最大字节数
+    int header_limit;
+
+    //消息体的最大字节数
+    int body_limit;
+
+    //长连接空闲超时秒数
+    int keepalive_timeout;
+
+    //每个连接最多处理的请求数，0为不限制
+    int max_requests;
+
+    //开始关闭空闲长连接的连接数，0为最大连接数的90%
+    int idle_high_water;
+
+    //接收请求头、接收消息体和发送响应的超时秒数
+    int header_timeout;
+    int body_timeout;
+    int write_timeout;
+
+    //消息体的最低接收速率(字节/秒)，每收到这么多字节消息体超时延长1秒，0为不延长
+    int body_rate;
+
+    //线程池调度方式
+    int sched;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include <stdlib.h>
+#include "block_pool.h"
+
+block_pool::block_pool() {
+}
+
+block_pool::~block_pool() {
+    for (size_t i = 0; i < m_free.size(); ++i)
+        free(m_free[i]);
+}
+
+block_pool *block_pool::get_instance() {
+    static block_pool pool;
+    return &pool;
+}
+
+char *block_pool::get(int size) {
+    if (size > BLOCK_SIZE)
+        return (char *)malloc(size);
+
+    char *block = NULL;
+    m_lock.lock();
+    if (!m_free.empty()) {
+        block = m_free.back();
+        m_free.pop_back();
+    }
+    m_lock.unlock();
+
+    if (!block)
+        block = (char *)malloc(BLOCK_SIZE);
+    return block;
+}
+
+void block_pool::put(char *block, int size) {
+    if (size <= BLOCK_SIZE) {
+        m_lock.lock();
+        if ((int)m_free.size() < MAX_FREE) {
+            m_free.push_back(block);
+            block = NULL;
+        }
+        m_lock.unlock();
+    }
+    free(block);
+}
@@ -0,0 +1,33 @@
+#ifndef BLOCK_POOL_H
+#define BLOCK_POOL_H
+/*
+输出块池
+===============
+响应报文超出连接内置的写缓冲区时，后续内容写入从这里取得的块，整批发送完毕后归还
+> * 单例模式，各工作线程、reactor和ring线程共用
+> * 标准大小的块归还后放入空闲链表复用，空闲块超过上限时直接释放
+> * 超过标准大小的块(单段内容比一个块还大)按需分配，归还时直接释放
+*/
+#include <vector>
+#include "../lock/locker.h"
+
+class block_pool {
+public:
+    static const int BLOCK_SIZE = 4096;     // 标准块大小
+    static const int MAX_FREE = 1024;       // 空闲链表中最多保留的块数
+
+    // 使用局部静态变量懒汉模式创建块池
+    static block_pool *get_instance();
+
+    char *get(int size);                    // 取得至少size字节的块，失败返回NULL
+    void put(char *block, int size);        // 归还get(size)取得的块
+
+private:
+    block_pool();
+    ~block_pool();
+
+    std::vector<char *> m_free;             // 空闲的标准块
+    locker m_lock;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#include "conn_lru.h"
+#include "http_conn.h"
+
+void conn_lru::touch(http_conn *conn) {
+    if (conn->m_lru == this && conn == tail)
+        return;
+    remove(conn);
+    conn->m_lru = this;
+    conn->m_lru_prev = tail;
+    conn->m_lru_next = NULL;
+    if (tail)
+        tail->m_lru_next = conn;
+    else
+        head = conn;
+    tail = conn;
+    ++m_size;
+}
+
+void conn_lru::remove(http_conn *conn) {
+    if (conn->m_lru != this)
+        return;
+    if (conn->m_lru_prev)
+        conn->m_lru_prev->m_lru_next = conn->m_lru_next;
+    else
+        head = conn->m_lru_next;
+    if (conn->m_lru_next)
+        conn->m_lru_next->m_lru_prev = conn->m_lru_prev;
+    else
+        tail = conn->m_lru_prev;
+    conn->m_lru = NULL;
+    conn->m_lru_prev = NULL;
+    conn->m_lru_next = NULL;
+    --m_size;
+}
@@ -0,0 +1,30 @@
+#ifndef CONN_LRU_H
+#define CONN_LRU_H
+/*
+空闲长连接LRU链表
+===============
+每个reactor一个，按最近一次进入空闲状态的先后串起该reactor上等待下一个请求的长连接
+> * 侵入式双向链表，结点指针保存在http_conn中，加入、移动、删除都是O(1)
+> * 头部是空闲最久的连接，连接数接近上限或描述符耗尽时从头部开始关闭，为新连接腾出位置
+> * 只由所属reactor线程访问，不加锁
+*/
+#include <stddef.h>
+
+class http_conn;
+
+class conn_lru {
+public:
+    conn_lru() : head(NULL), tail(NULL), m_size(0) {}
+
+    void touch(http_conn *conn);    // 连接进入空闲状态，加入或移到尾部
+    void remove(http_conn *conn);   // 连接不再空闲或已关闭，不在链表中时什么也不做
+    http_conn *oldest() const { return head; }
+    int size() const { return m_size; }
+
+private:
+    http_conn *head;
+    http_conn *tail;
+    int m_size;
+};
+
+#endif
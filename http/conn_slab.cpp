@@ -0,0 +1,88 @@
+#include "conn_slab.h"
+#include "http_conn.h"
+
+conn_slab::conn_slab() : m_table(NULL), m_max_fd(0), m_min_free(0), m_grace(0), m_live(0) {
+}
+
+conn_slab::~conn_slab() {
+    for (int i = 0; i < m_max_fd; ++i)
+        delete m_table[i];
+    for (size_t i = 0; i < m_free.size(); ++i)
+        delete m_free[i].conn;
+    free(m_table);
+}
+
+conn_slab *conn_slab::get_instance() {
+    static conn_slab slab;
+    return &slab;
+}
+
+void conn_slab::init(int max_fd, int min_free, int grace) {
+    // calloc得到的大块内存直接来自mmap，只有写入过的页才占用物理内存
+    m_table = (http_conn **)calloc(max_fd, sizeof(http_conn *));
+    assert(m_table);
+    m_max_fd = max_fd;
+    m_min_free = min_free;
+    m_grace = grace;
+}
+
+http_conn *conn_slab::get(int fd) {
+    if (fd < 0 || fd >= m_max_fd)
+        return NULL;
+
+    http_conn *conn = NULL;
+    m_lock.lock();
+    if (!m_free.empty()) {
+        conn = m_free.back().conn;
+        m_free.pop_back();
+    }
+    ++m_live;
+    m_lock.unlock();
+
+    if (!conn)
+        conn = new http_conn;
+    m_table[fd] = conn;
+    return conn;
+}
+
+// 连接代数加1，尚未处理的事件和完成通知中的旧句柄随之失效
+void conn_slab::put(int fd) {
+    http_conn *conn = find(fd);
+    if (!conn)
+        return;
+    m_table[fd] = NULL;
+    // 空闲的长连接被关闭时从所属reactor的LRU链表中摘除
+    if (conn->m_lru)
+        conn->m_lru->remove(conn);
+    conn->next_gen();
+    //连接在发送文件的中途关闭时，释放尚未释放的文件映射或文件描述符
+    conn->unmap();
+    http_conn::m_user_count--;
+
+    free_conn item;
+    item.conn = conn;
+    item.since = cached_clock::get_instance()->now_sec();
+    m_lock.lock();
+    m_free.push_back(item);
+    --m_live;
+    m_lock.unlock();
+}
+
+// 空闲链表头部是最早回收的对象，依次释放直到遇到宽限期内的对象或只剩min_free个
+void conn_slab::trim() {
+    time_t now = cached_clock::get_instance()->now_sec();
+    std::vector<http_conn *> expired;
+
+    m_lock.lock();
+    size_t n = 0;
+    while (n < m_free.size() && (int)(m_free.size() - n) > m_min_free &&
+           m_free[n].since + m_grace <= now) {
+        expired.push_back(m_free[n].conn);
+        ++n;
+    }
+    m_free.erase(m_free.begin(), m_free.begin() + n);
+    m_lock.unlock();
+
+    for (size_t i = 0; i < expired.size(); ++i)
+        delete expired[i];
+}
@@ -0,0 +1,56 @@
+#ifndef CONN_SLAB_H
+#define CONN_SLAB_H
+/*
+连接对象池
+===============
+按fd索引http_conn对象，连接建立时才分配，关闭后回收
+> * 单例模式，各reactor与定时器回调共用
+> * 索引表按RLIMIT_NOFILE分配，只存放指针，未使用的部分不占用物理内存
+> * 关闭的连接对象放入空闲链表，新连接优先复用最近回收的对象
+> * 空闲对象在链表中停留超过宽限期后才释放，完成队列或工作线程中迟到的引用不会访问已释放的内存
+*/
+#include <vector>
+#include <time.h>
+#include "../lock/locker.h"
+
+class http_conn;
+
+class conn_slab {
+public:
+    // 使用局部静态变量懒汉模式创建对象池
+    static conn_slab *get_instance();
+
+    // max_fd为索引表大小，min_free为释放空闲对象时至少保留的数量，grace为空闲对象的最短保留时间(秒)
+    void init(int max_fd, int min_free, int grace);
+
+    http_conn *get(int fd);     // 为新连接分配对象并绑定到fd
+    void put(int fd);           // 连接关闭后解除绑定，对象进入空闲链表，连接数减一
+    void trim();                // 释放超过宽限期的空闲对象，由定时任务调用
+
+    // 取得fd当前绑定的对象，连接已关闭时返回NULL
+    http_conn *find(int fd) const {
+        return (fd >= 0 && fd < m_max_fd) ? m_table[fd] : NULL;
+    }
+    int max_fd() const { return m_max_fd; }
+    int live() const { return m_live; }
+    int free_count() const { return m_free.size(); }
+
+private:
+    conn_slab();
+    ~conn_slab();
+
+    struct free_conn {
+        http_conn *conn;
+        time_t since;           // 进入空闲链表的时间
+    };
+
+    http_conn **m_table;        // fd到对象的索引表
+    int m_max_fd;
+    int m_min_free;
+    int m_grace;
+    int m_live;                 // 已绑定到fd的对象数
+    std::vector<free_conn> m_free;  // 空闲链表，尾部为最近回收的对象
+    locker m_lock;
+};
+
+#endif
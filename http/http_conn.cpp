@@ -11,6 +11,10 @@ const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file form this server.\n";
 const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
+const char *error_413_title = "Payload Too Large";
+const char *error_413_form = "The request body is larger than the server is willing to process.\n";
+const char *error_431_title = "Request Header Fields Too Large";
+const char *error_431_form = "The request header fields are larger than the server is willing to process.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
 
@@ -52,10 +56,11 @@ int setnonblocking(int fd) {
     return old_option;
 }
 
-// 将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
-void addfd(int epollfd, int fd, bool one_shot, int TRIGMode) {
+// 将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT，事件中携带连接句柄
+// 连接socket由accept4直接创建为非阻塞，这里不再调用fcntl
+void addfd(int epollfd, int fd, uint64_t handle, bool one_shot, int TRIGMode) {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = handle;
 
     if (1 == TRIGMode)
         event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
@@ -65,60 +70,74 @@ void addfd(int epollfd, int fd, bool one_shot, int TRIGMode) {
     if (one_shot)
         event.events |= EPOLLONESHOT;
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    setnonblocking(fd);
 }
 
-// 从内核事件表删除事件
-void removefd(int epollfd, int fd) {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
-    close(fd);
-}
-
-// 将事件重置为EPOLLONESHOT
-void modfd(int epollfd, int fd, int ev, int TRIGMode) {
+// 修改连接注册的事件
+// io_uring模式下连接不在epoll中(epollfd为-1)
+void modfd(int epollfd, int fd, uint64_t handle, int ev, int TRIGMode) {
+    if (epollfd < 0)
+        return;
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = handle;
 
     if (1 == TRIGMode)
-        event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+        event.events = ev | EPOLLET | EPOLLRDHUP;
     else
-        event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
+        event.events = ev | EPOLLRDHUP;
 
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
-
-//关闭连接，关闭一个连接，客户总量减一
+std::atomic<int> http_conn::m_user_count(0);
+int http_conn::m_header_limit = 8192;
+int http_conn::m_body_limit = 1048576;
+std::atomic<unsigned long> http_conn::m_write_total(0);
+std::atomic<unsigned long> http_conn::m_write_inline(0);
+int http_conn::m_max_requests = 0;
+std::atomic<unsigned long> http_conn::m_request_total(0);
+std::atomic<unsigned long> http_conn::m_request_reused(0);
+
+//关闭连接: 工作线程中只关闭读写，fd由所属reactor在挂断事件或完成通知中关闭并回收，
+//客户总量在回收时减一。工作线程直接close的fd可能被新连接复用，随后又被定时器误关
 void http_conn::close_conn(bool real_close) {
     if (real_close && (m_sockfd != -1)) {
         printf("close %d\n", m_sockfd);
-        removefd(m_epollfd, m_sockfd);
+        shutdown(m_sockfd, SHUT_RDWR);
         m_sockfd = -1;
-        m_user_count--;
     }
 }
 
 //初始化连接,外部调用初始化套接字地址
 void http_conn::init(int sockfd, 
+                     int epollfd,
                      const sockaddr_in &addr,
                      char *root,
                      int TRIGMode,
                      int close_log, 
+                     int send_mode,
+                     bool one_shot,
                      string user, 
                      string passwd, 
                      string sqlname) {
     m_sockfd = sockfd;
+    m_fd = sockfd;
+    m_epollfd = epollfd;
     m_address = addr;
-
-    addfd(m_epollfd, sockfd, true, m_TRIGMode);
+    m_TRIGMode = TRIGMode;
+    m_one_shot = one_shot;
+    m_busy = false;
+    m_deferred = 0;
+    m_interest = EPOLLIN;
+
+    // 连接只注册一次，由归属关系保证同一时刻只有一个线程处理连接，事件只在读写关注变化时修改
+    if (m_epollfd >= 0)
+        addfd(m_epollfd, sockfd, handle(), m_one_shot, m_TRIGMode);
     m_user_count++;
 
     //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;
-    m_TRIGMode = TRIGMode;
     m_close_log = close_log;
+    m_send_mode = send_mode;
 
     strcpy(sql_user, user.c_str());
     strcpy(sql_passwd, passwd.c_str());
@@ -127,6 +146,13 @@ void http_conn::init(int sockfd,
     init();
 }
 
+// 修改注册的读写事件，ev为0时暂停通知: 只保留EPOLLONESHOT，挂断事件也最多再报告一次，
+// 用于LT模式下连接归属工作线程期间，避免未处理的就绪状态使事件循环空转；m_one_shot的连接总是带EPOLLONESHOT
+void http_conn::set_interest(int ev) {
+    modfd(m_epollfd, m_fd, handle(), (ev && !m_one_shot) ? ev : ev | EPOLLONESHOT, m_TRIGMode);
+    m_interest = ev;
+}
+
 //初始化新接受的连接
 //check_state默认为分析请求行状态
 void http_conn::init() {
@@ -135,6 +161,12 @@ void http_conn::init() {
     bytes_have_send = 0;
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
+    m_keep_alive = false;
+    m_requests = 0;
+    m_pipelined = false;
+    m_db_pending = false;
+    m_batch_count = 0;
+    m_unread = false;
     m_method = GET;
     m_url = 0;
     m_version = 0;
@@ -143,17 +175,93 @@ void http_conn::init() {
     m_start_line = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
-    m_write_idx = 0;
+    release_blocks();
+    m_iv.clear();
+    m_iv_idx = 0;
     cgi = 0;
     m_state = 0;
     timer_flag = 0;
-    improv = 0;
 
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
+    // 对象复用时换回内置读缓冲区
+    if (m_read_buf != m_read_local) {
+        free(m_read_buf);
+        m_read_buf = m_read_local;
+        m_read_size = READ_BUFFER_SIZE;
+    }
+    memset(m_read_buf, '\0', READ_BUFFER_SIZE + 1);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
     memset(m_real_file, '\0', FILENAME_LEN);
 }
 
+// HTTP/1.1流水线: 客户端可以不等响应连续发出多个请求，这些请求可能被一次读入m_read_buf，
+// 当前请求之后的数据属于后续请求，不能随请求处理完毕一起丢弃
+void http_conn::next_request() {
+    // POST消息体结尾的\0覆盖了下一个请求的第一个字节，先恢复
+    if (m_check_state == CHECK_STATE_CONTENT)
+        m_read_buf[m_checked_idx] = m_body_tail;
+    m_read_idx -= m_checked_idx;
+    memmove(m_read_buf, m_read_buf + m_checked_idx, m_read_idx);
+    // 数据之后的部分保持为\0，不完整的行和消息体按字符串打印日志时不会读到残留数据
+    memset(m_read_buf + m_read_idx, '\0', m_checked_idx);
+    m_checked_idx = 0;
+    m_start_line = 0;
+
+    m_check_state = CHECK_STATE_REQUESTLINE;
+    m_linger = false;
+    m_method = GET;
+    m_url = 0;
+    m_version = 0;
+    m_content_length = 0;
+    m_host = 0;
+    cgi = 0;
+    shrink_read();
+}
+
+bool http_conn::grow_read(int need) {
+    int size = m_read_size;
+    while (size < need)
+        size *= 2;
+    if (size > read_limit())
+        size = read_limit();
+    if (size < need)
+        return false;
+    char *buf = (char *)malloc(size + 1);
+    if (!buf)
+        return false;
+    memcpy(buf, m_read_buf, m_read_idx);
+    memset(buf + m_read_idx, '\0', size + 1 - m_read_idx);
+    // 请求头不完整时，已解析的请求行和Host仍指向旧缓冲区
+    if (m_url)
+        m_url = buf + (m_url - m_read_buf);
+    if (m_version)
+        m_version = buf + (m_version - m_read_buf);
+    if (m_host)
+        m_host = buf + (m_host - m_read_buf);
+    if (m_read_buf != m_read_local)
+        free(m_read_buf);
+    m_read_buf = buf;
+    m_read_size = size;
+    return true;
+}
+
+void http_conn::shrink_read() {
+    if (m_read_buf == m_read_local || m_read_idx > READ_BUFFER_SIZE)
+        return;
+    memcpy(m_read_local, m_read_buf, m_read_idx);
+    memset(m_read_local + m_read_idx, '\0', READ_BUFFER_SIZE + 1 - m_read_idx);
+    free(m_read_buf);
+    m_read_buf = m_read_local;
+    m_read_size = READ_BUFFER_SIZE;
+}
+
+void http_conn::next_batch() {
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    release_blocks();
+    m_iv.clear();
+    m_iv_idx = 0;
+}
+
 // 从状态机，用于分析出一行内容
 // 返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN
 // m_read_idx指向缓冲区m_read_buf的数据末尾的下一个字节
@@ -195,27 +303,59 @@ http_conn::LINE_STATUS http_conn::parse_line() {
     return LINE_OPEN;
 }
 
+// 读取一次: readv的第一段是读缓冲区的剩余空间，第二段是调用者栈上的溢出区。
+// 读缓冲区放得下时与recv相同，放不下时才扩容并把溢出区中的数据拷入，一次系统调用读入尽量多的数据
+int http_conn::recv_spill(char *spill) {
+    int space = m_read_size - m_read_idx;
+    int spill_len = read_limit() - m_read_size;
+    if (spill_len > READ_SPILL_SIZE)
+        spill_len = READ_SPILL_SIZE;
+
+    struct iovec iv[2];
+    iv[0].iov_base = m_read_buf + m_read_idx;
+    iv[0].iov_len = space;
+    iv[1].iov_base = spill;
+    iv[1].iov_len = spill_len;
+    int bytes_read = readv(m_sockfd, iv, spill_len > 0 ? 2 : 1);
+    if (bytes_read <= space) {
+        if (bytes_read > 0)
+            m_read_idx += bytes_read;
+        return bytes_read;
+    }
+
+    m_read_idx = m_read_size;
+    if (!grow_read(m_read_idx + bytes_read - space)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(m_read_buf + m_read_idx, spill, bytes_read - space);
+    m_read_idx += bytes_read - space;
+    return bytes_read;
+}
+
 // 循环读取客户数据到m_read_buffer中，并更新m_read_idx，直到无数据可读或对方关闭连接
 // 非阻塞ET工作模式下，需要一次性将数据读完
+// 请求超过内置缓冲区时读缓冲区按需扩容，大小由请求头和消息体的上限约束，超限的请求由process_read返回431/413
 bool http_conn::read_once() {
-    if (m_read_idx >= READ_BUFFER_SIZE) {
+    if (m_read_idx >= read_limit()) {
         return false;
     }
     int bytes_read = 0;
+    char spill[READ_SPILL_SIZE];
 
-    
     if (0 == m_TRIGMode) {  //LT读取数据
         // 从套接字接收数据，存储在m_read_buf缓冲区
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-        m_read_idx += bytes_read;
+        bytes_read = recv_spill(spill);
         if (bytes_read <= 0) {
             return false;
         }
         return true;
     } else {    //ET读数据
-        while (true) {
+        m_unread = false;
+        while (m_read_idx < read_limit()) {
             // 从套接字接收数据，存储在m_read_buf缓冲区
-            bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+            // 缓冲区达到上限时先停止并置m_unread，连接交还事件循环时EPOLL_CTL_MOD会再次报告未读完的数据
+            bytes_read = recv_spill(spill);
             if (bytes_read == -1) {
                 // 非阻塞ET模式下，需要一次性将数据读完
                 if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -224,13 +364,22 @@ bool http_conn::read_once() {
             } else if (bytes_read == 0) {
                 return false;
             }
-            // 修改m_read_idx的读取字节数
-            m_read_idx += bytes_read;
         }
+        m_unread = m_read_idx >= read_limit();
         return true;
     }
 }
 
+// io_uring后端收到数据后，由ring线程将provided buffer中的数据拷贝到m_read_buf
+bool http_conn::fill_read(const char *data, int len) {
+    if (len > m_read_size - m_read_idx && !grow_read(m_read_idx + len)) {
+        return false;
+    }
+    memcpy(m_read_buf + m_read_idx, data, len);
+    m_read_idx += len;
+    return true;
+}
+
 //解析http请求行，获得请求方法，目标url及http版本号
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
     // 在HTTP报文中，请求行用来说明请求类型,要访问的资源以及所使用的HTTP版本，其中各个部分之间通过\t或空格分隔。
@@ -263,8 +412,11 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
     *m_version++ = '\0';
     m_version += strspn(m_version, " \t");
 
-    // 仅支持HTTP/1.1
-    if (strcasecmp(m_version, "HTTP/1.1") != 0)
+    // 支持HTTP/1.1和HTTP/1.0: HTTP/1.1默认保持连接，HTTP/1.0默认短连接，
+    // 都可以再由Connection头部改变
+    if (strcasecmp(m_version, "HTTP/1.1") == 0)
+        m_linger = true;
+    else if (strcasecmp(m_version, "HTTP/1.0") != 0)
         return BAD_REQUEST;
     
     // 对请求资源前7个字符进行判断
@@ -302,19 +454,34 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text) {
         }
         return GET_REQUEST;
     } else if (strncasecmp(text, "Connection:", 11) == 0) {
-        // 解析请求头部连接字段
+        // 解析请求头部连接字段，值是逗号分隔的选项列表，同时出现时close优先
         text += 11;
-        // 跳过空格和\t字符
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0) {
-            // 如果是长连接，则将linger标志设置为true
-            m_linger = true;
+        bool close = false, keep_alive = false;
+        while (*text) {
+            // 跳过空格、\t字符和逗号，取出一个选项
+            text += strspn(text, " \t,");
+            int len = strcspn(text, " \t,");
+            if (5 == len && strncasecmp(text, "close", 5) == 0)
+                close = true;
+            else if (10 == len && strncasecmp(text, "keep-alive", 10) == 0)
+                keep_alive = true;
+            text += len;
         }
+        if (close)
+            m_linger = false;
+        else if (keep_alive)
+            m_linger = true;
     } else if (strncasecmp(text, "Content-length:", 15) == 0) {
         // 解析请求头部内容长度字段
         text += 15;
         text += strspn(text, " \t");
-        m_content_length = atol(text);
+        long content_length = atol(text);
+        if (content_length < 0)
+            return BAD_REQUEST;
+        // 消息体超过上限时不再读取，直接返回413
+        if (content_length > m_body_limit)
+            return BODY_TOO_LARGE;
+        m_content_length = content_length;
     } else if (strncasecmp(text, "Host:", 5) == 0) {
         // 解析请求头部HOST字段
         text += 5;
@@ -330,6 +497,9 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text) {
 http_conn::HTTP_CODE http_conn::parse_content(char *text) {
     // 判断buffer中是否读取了消息体
     if (m_read_idx >= (m_content_length + m_checked_idx)) {
+        // 消息体之后可能紧跟下一个流水线请求，记下被\0覆盖的字节，由next_request恢复
+        m_checked_idx += m_content_length;
+        m_body_tail = m_read_buf[m_checked_idx];
         text[m_content_length] = '\0';
         // POST请求中最后为输入的用户名和密码
         m_string = text;
@@ -345,9 +515,13 @@ http_conn::HTTP_CODE http_conn::process_read() {
     char *text = 0;
 
     // parse_line为从状态机的具体实现
+    // 消息体不按行解析，不完整时不能交给parse_line，否则m_checked_idx越过消息体，与后续流水线请求错位
     while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || 
-           ((line_status = parse_line()) == LINE_OK)) 
+           (m_check_state != CHECK_STATE_CONTENT && (line_status = parse_line()) == LINE_OK)) 
     {
+        // 请求行和请求头超过上限，消息体的大小由Content-Length单独限制
+        if (m_check_state != CHECK_STATE_CONTENT && m_checked_idx > m_header_limit)
+            return HEADER_TOO_LARGE;
         text = get_line();
         //m_start_line是每一个数据行在m_read_buf中的起始位置
         //m_checked_idx表示从状态机在m_read_buf中读取的位置
@@ -368,8 +542,8 @@ http_conn::HTTP_CODE http_conn::process_read() {
         {
             //解析请求头
             ret = parse_headers(text);
-            if (ret == BAD_REQUEST)
-                return BAD_REQUEST;
+            if (ret == BAD_REQUEST || ret == BODY_TOO_LARGE)
+                return ret;
             //完整解析GET请求后，跳转到报文响应函数
             else if (ret == GET_REQUEST)
             {
@@ -392,6 +566,9 @@ http_conn::HTTP_CODE http_conn::process_read() {
             return INTERNAL_ERROR;
         }
     }
+    // 请求头尚不完整，已读入的部分却已达到上限
+    if (m_check_state != CHECK_STATE_CONTENT && m_read_idx >= m_header_limit)
+        return HEADER_TOO_LARGE;
     return NO_REQUEST;
 }
 
@@ -429,6 +606,9 @@ http_conn::HTTP_CODE http_conn::do_request()
     //处理cgi, 实现登录和注册校验
     if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
     {
+        //静态文件线程池不持有数据库连接，请求已解析完，交给数据库线程池从这里继续
+        if (!mysql)
+            return DB_REQUEST;
 
         //根据标志判断是登录检测还是注册检测
         char flag = m_url[1];
@@ -553,8 +733,22 @@ http_conn::HTTP_CODE http_conn::do_request()
     //判断文件类型，如果是目录，则返回BAD_REQUEST，表示请求报文有误
     if (S_ISDIR(m_file_stat.st_mode))
         return BAD_REQUEST;
-    //以只读方式获取文件描述符，通过mmap将该文件映射到内存中
-    int fd = open(m_real_file, O_RDONLY);
+    //以只读方式获取文件描述符
+    int fd = open(m_real_file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NO_RESOURCE;
+    //sendfile模式保留文件描述符，发送时由内核直接从页缓存拷贝到socket，
+    //省去每个请求的mmap/munmap，munmap在多核上会引发各核的TLB shootdown
+    if (1 == m_send_mode) {
+        if (m_file_stat.st_size > 0) {
+            m_file_fd = fd;
+            m_file_offset = 0;
+        } else {
+            close(fd);
+        }
+        return FILE_REQUEST;
+    }
+    //通过mmap将该文件映射到内存中
     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     //避免文件描述符的浪费和占用
     close(fd);
@@ -562,10 +756,18 @@ http_conn::HTTP_CODE http_conn::do_request()
     return FILE_REQUEST;
 }
 void http_conn::unmap() {
+    for (int i = 0; i < m_map_count; ++i)
+        munmap(m_maps[i].address, m_maps[i].size);
+    m_map_count = 0;
     if (m_file_address) {
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
     }
+    if (m_file_fd >= 0) {
+        close(m_file_fd);
+        m_file_fd = -1;
+    }
+    release_blocks();
 }
 
 
@@ -585,104 +787,207 @@ void http_conn::unmap() {
              （当写缓冲区从不可写变为可写，触发epollout），因此在此期间无法立即接收到同一用户的下一请求，
               但可以保证连接的完整性。
 */
-bool http_conn::write() {
-    int temp = 0;
+bool http_conn::write(bool &pipelined) {
+    pipelined = false;
     //若要发送的数据长度为0
     //表示响应报文为空，一般不会出现这种情况
     if (bytes_to_send == 0) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-        init();
+        next_batch();
         return true;
     }
 
-    while (1) {
+    //缓冲区满了，pending_bytes()仍大于0，由事件循环继续关注写事件
+    int ret = send_batch();
+    if (0 == ret)
+        return true;
+    if (ret < 0)
+        return false;
+    return finish_batch(pipelined);
+}
+
+// 发送本批响应直到全部发出(返回1)、socket缓冲区满(返回0)或出错(返回-1)，不修改epoll事件
+int http_conn::send_batch() {
+    int temp = 0;
+    while (bytes_to_send > 0) {
         // 将响应报文的状态行、消息头、空行和响应正文发送给浏览器端
         // #include <sys/uio.h>
         // ssize_t writev(int filedes /*文件描述符*/ , 
         //                const struct iovec *iov /*io向量机制结构体iovec*/, 
         //                int iovcnt /*iov个数*/);
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        if (m_file_fd >= 0) {
+            temp = sendfile_once();
+        } else {
+            // 链上的iovec超过IOV_MAX时分多次writev发出
+            int count = 0;
+            struct iovec *iv = get_iovec(&count);
+            temp = writev(m_sockfd, iv, count);
+        }
         
         if (temp < 0){
             //判断缓冲区是否满了
-            if (errno == EAGAIN) {
-                //重新注册写事件
-                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
-                return true;
-            }
+            if (errno == EAGAIN)
+                return 0;
             //如果发送失败，但不是缓冲区问题，取消映射
             unmap();
-            return false;
+            return -1;
         }
         
-        //更新已发送字节数
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-        // struct iovec {
-        //     void      *iov_base;      /* starting address of buffer */
-        //     size_t    iov_len;        /* size of buffer */
-        // };
-        //第一个iovec头部信息的数据已发送完，发送第二个iovec数据
-        if (bytes_have_send >= m_iv[0].iov_len) {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        } else {
-            // 否则继续发送第一个iovec头部信息的数据
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-        }
+        //更新已发送字节数，调整iovec
+        update_iovec(temp);
+    }
+    return 1;
+}
 
-        // 判断条件，数据已全部发送完
-        if (bytes_to_send <= 0) {
-            unmap();
-            // 在epoll树上重置EPOLLONESHOT事件
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-            // 浏览器的请求为长连接
-            if (m_linger) {
-                // 重新初始化HTTP对象
-                init();
-                return true;
-            } else {
-                return false;
-            }
+// 数据已全部发送完: 短连接返回false由调用者关闭；长连接重置发送状态，
+// 读缓冲区中还有流水线请求时置pipelined
+bool http_conn::finish_batch(bool &pipelined) {
+    unmap();
+    // 短连接由调用者关闭
+    if (!m_keep_alive)
+        return false;
+    // 重置发送状态，读缓冲区中的流水线请求保留
+    next_batch();
+    // 还有完整的请求未处理，交给调用者继续process
+    pipelined = m_pipelined;
+    return true;
+}
+
+void http_conn::update_iovec(int bytes) {
+    bytes_have_send += bytes;
+    bytes_to_send -= bytes;
+    // struct iovec {
+    //     void      *iov_base;      /* starting address of buffer */
+    //     size_t    iov_len;        /* size of buffer */
+    // };
+    //跳过已全部发出的iovec，部分发出的iovec调整起始地址和剩余长度
+    while (bytes > 0 && m_iv_idx < (int)m_iv.size()) {
+        struct iovec *iv = &m_iv[m_iv_idx];
+        if ((size_t)bytes < iv->iov_len) {
+            iv->iov_base = (char *)iv->iov_base + bytes;
+            iv->iov_len -= bytes;
+            break;
         }
+        bytes -= iv->iov_len;
+        iv->iov_len = 0;
+        ++m_iv_idx;
+    }
+}
+
+void http_conn::add_iovec(char *base, int len) {
+    if (len <= 0)
+        return;
+    if (!m_iv.empty() && (char *)m_iv.back().iov_base + m_iv.back().iov_len == base) {
+        m_iv.back().iov_len += len;
+    } else {
+        struct iovec iv;
+        iv.iov_base = base;
+        iv.iov_len = len;
+        m_iv.push_back(iv);
+    }
+    bytes_to_send += len;
+}
+
+void http_conn::flush_block() {
+    add_iovec(m_out + m_out_start, m_write_idx - m_out_start);
+    m_out_start = m_write_idx;
+}
+
+bool http_conn::next_block(int need) {
+    flush_block();
+    int size = need > block_pool::BLOCK_SIZE ? need : block_pool::BLOCK_SIZE;
+    char *block = block_pool::get_instance()->get(size);
+    if (!block)
+        return false;
+    out_block b;
+    b.base = block;
+    b.size = size;
+    m_blocks.push_back(b);
+    m_out = block;
+    m_out_size = size;
+    m_write_idx = 0;
+    m_out_start = 0;
+    return true;
+}
+
+void http_conn::release_blocks() {
+    for (size_t i = 0; i < m_blocks.size(); ++i)
+        block_pool::get_instance()->put(m_blocks[i].base, m_blocks[i].size);
+    m_blocks.clear();
+    m_out = m_write_buf;
+    m_out_size = WRITE_BUFFER_SIZE;
+    m_write_idx = 0;
+    m_out_start = 0;
+}
+
+// sendfile模式: 先发送链上剩余的响应头，带MSG_MORE使其与文件开头合并成尽量少的报文，
+// 响应头发完后由sendfile从m_file_offset处继续发送文件，sendfile自行推进偏移，EAGAIN后可从断点恢复
+int http_conn::sendfile_once() {
+    if (m_iv_idx < (int)m_iv.size()) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        int count = 0;
+        msg.msg_iov = get_iovec(&count);
+        msg.msg_iovlen = count;
+        return sendmsg(m_sockfd, &msg, MSG_MORE);
     }
+    return sendfile(m_sockfd, m_file_fd, &m_file_offset, bytes_to_send);
+}
+
+// io_uring后端发送完成后调用，全部发送完则取消映射，长连接重置http对象
+int http_conn::advance(int bytes) {
+    update_iovec(bytes);
+    if (bytes_to_send > 0) {
+        return bytes_to_send;
+    }
+    unmap();
+    if (m_keep_alive) {
+        next_batch();
+    }
+    return 0;
 }
 
 /**
- *    根据do_request的返回状态，服务器子线程调用process_write向m_write_buf中写入响应报文。
+ *    根据do_request的返回状态，服务器子线程调用process_write向输出缓冲区中写入响应报文。
  *    add_status_line函数，添加状态行：http/1.1 状态码 状态消息
  *    add_headers函数添加消息报头，内部调用add_content_length和add_linger函数
  *          content-length记录响应报文长度，用于浏览器端判断服务器是否发送完数据
  *          connection记录连接状态，用于告诉浏览器端保持长连接
  *    add_blank_line添加空行
- *   上述函数均是内部调用add_response函数更新m_write_idx指针和缓冲区m_write_buf中的内容。
+ *   上述函数均是内部调用add_response或add_data函数更新m_write_idx指针和当前块m_out中的内容，
+ *   当前块写满时换用block_pool中的新块，响应头的大小不受m_write_buf限制。
  */
 
 bool http_conn::add_response(const char *format, ...) {
-    //如果写入内容超出m_write_buf大小则报错
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
-        return false;
     //定义可变参数列表
     va_list arg_list;
     //将变量arg_list初始化为传入参数
     va_start(arg_list, format);
-    //将数据format从可变参数列表写入缓冲区写，返回写入数据的长度
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    
-    //如果写入的数据长度超过缓冲区剩余空间，则报错
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx)) {
-        va_end(arg_list);
+    //将数据format从可变参数列表写入当前块，返回写入数据的长度
+    int len = vsnprintf(m_out + m_write_idx, m_out_size - m_write_idx, format, arg_list);
+    //清空可变参列表
+    va_end(arg_list);
+    if (len < 0)
         return false;
+
+    //当前块剩余空间不足，换一个放得下的块重新格式化
+    if (len >= m_out_size - m_write_idx) {
+        if (!next_block(len + 1))
+            return false;
+        va_start(arg_list, format);
+        vsnprintf(m_out + m_write_idx, m_out_size - m_write_idx, format, arg_list);
+        va_end(arg_list);
     }
+    LOG_INFO("request:%s", m_out + m_write_idx);
     //更新m_write_idx位置
     m_write_idx += len;
-    //清空可变参列表
-    va_end(arg_list);
-
-    LOG_INFO("request:%s", m_write_buf);
+    return true;
+}
 
+bool http_conn::add_data(const char *data, int len) {
+    if (len > m_out_size - m_write_idx && !next_block(len))
+        return false;
+    memcpy(m_out + m_write_idx, data, len);
+    m_write_idx += len;
     return true;
 }
 
@@ -690,11 +995,11 @@ bool http_conn::add_response(const char *format, ...) {
 bool http_conn::add_status_line(int status, const char *title) {
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
-//添加Content-Length，表示响应报文的长度
+//添加Date、Content-Length、连接状态和空行，合并为一次格式化，Date使用时钟缓存的字符串
 bool http_conn::add_headers(int content_len) {
-    return add_content_length(content_len) && 
-           add_linger() &&
-           add_blank_line();
+    return add_response("Date:%s\r\nContent-Length:%d\r\nConnection:%s\r\n\r\n",
+                        cached_clock::get_instance()->http_date(),
+                        content_len, (m_linger == true) ? "keep-alive" : "close");
 }
 //添加Content-Length，表示响应报文的长度
 bool http_conn::add_content_length(int content_len) {
@@ -710,16 +1015,17 @@ bool http_conn::add_linger() {
 }
 //添加空行
 bool http_conn::add_blank_line() {
-    return add_response("%s", "\r\n");
+    return add_data("\r\n", 2);
 }
 //添加文本content
 bool http_conn::add_content(const char *content) {
-    return add_response("%s", content);
+    return add_data(content, strlen(content));
 }
 /**
  * 响应报文分为两种，一种是请求文件的存在，通过io向量机制iovec，声明两个iovec，
- * 第一个指向m_write_buf，第二个指向mmap的地址m_file_address；
- * 一种是请求出错，这时候只申请一个iovec，指向m_write_buf。
+ * 第一个指向输出缓冲区，第二个指向mmap的地址m_file_address；
+ * 一种是请求出错，这时候只申请一个iovec，指向输出缓冲区。
+ * 流水线请求的响应依次追加在输出缓冲区和m_iv之后，相邻的响应头合并为一个iovec，整批用writev发出，超过IOV_MAX项时分多次发出。
  *
  * iovec是一个结构体，里面有两个元素:
  * 1、指针成员iov_base指向一个缓冲区，这个缓冲区是存放的是writev将要发送的数据。 
@@ -748,6 +1054,25 @@ bool http_conn::process_write(HTTP_CODE ret) {
             return false;
         break;
     }
+    // 请求头过大431，消息体过大413，请求的剩余部分不再读取，响应发完后关闭连接
+    case HEADER_TOO_LARGE:
+    {
+        m_linger = false;
+        add_status_line(431, error_431_title);
+        add_headers(strlen(error_431_form));
+        if (!add_content(error_431_form))
+            return false;
+        break;
+    }
+    case BODY_TOO_LARGE:
+    {
+        m_linger = false;
+        add_status_line(413, error_413_title);
+        add_headers(strlen(error_413_form));
+        if (!add_content(error_413_form))
+            return false;
+        break;
+    }
     // 资源没有访问权限，403
     case FORBIDDEN_REQUEST:
     {
@@ -765,15 +1090,20 @@ bool http_conn::process_write(HTTP_CODE ret) {
         if (m_file_stat.st_size != 0)
         {
             add_headers(m_file_stat.st_size);
-            // 第一个iovec指针指向响应报文缓冲区，长度指向m_write_idx
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            // 第二个iovec指针指向mmap返回的文件指针，长度指向文件大小
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            // 发送的全部数据为响应报文头部信息和文件大小
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
+            // 响应头所在的iovec指向输出缓冲区
+            flush_block();
+            // sendfile模式下iovec只有响应头，文件内容由sendfile发送
+            if (m_file_fd >= 0)
+            {
+                bytes_to_send += m_file_stat.st_size;
+                return true;
+            }
+            // 文件内容的iovec指向mmap返回的文件指针，长度为文件大小，映射在整批发送完后释放
+            add_iovec(m_file_address, m_file_stat.st_size);
+            m_maps[m_map_count].address = m_file_address;
+            m_maps[m_map_count].size = m_file_stat.st_size;
+            ++m_map_count;
+            m_file_address = 0;
             return true;
         }
         else
@@ -784,33 +1114,114 @@ bool http_conn::process_write(HTTP_CODE ret) {
             if (!add_content(ok_string))
                 return false;
         }
+        break;
     }
     default:
         return false;
     }
-    // 除FILE_REQUEST状态外，其余状态只申请一个iovec，指向响应报文缓冲区
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    // 除FILE_REQUEST状态外，响应报文全部在输出缓冲区中
+    flush_block();
     return true;
 }
 
 // 各子线程通过process函数对任务进行处理，
 // 调用process_read函数和process_write函数分别完成报文解析与报文响应两个任务。
+// 读缓冲区中的流水线请求逐个处理，响应合并为一批，由工作线程直接尝试发送。
+// 工作线程不修改epoll: 返回后连接经完成队列交还事件循环，由事件循环根据连接状态
+// (已关闭、还有未发完的数据或等待新请求)决定关闭连接、关注写事件还是关注读事件
 void http_conn::process() {
-    HTTP_CODE read_ret = process_read();
-    // NO_REQUEST，表示请求不完整，需要继续接收请求数据
-    if (read_ret == NO_REQUEST) {
-        //  注册并监听读事件
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-        return;
+    while (true) {
+        int count = build_batch();
+        // 请求不完整、需要交给数据库线程池或连接已关闭；io_uring模式下由ring线程发送
+        if (0 == count || m_db_pending || is_closed() || m_epollfd < 0)
+            return;
+
+        // 乐观写: 响应通常能一次放入socket发送缓冲区，直接发送可以省去一轮epoll_wait
+        // 和一次线程切换，只有发送缓冲区满时才交给事件循环关注写事件
+        m_write_total += count;
+        int ret = send_batch();
+        if (0 == ret)
+            return;
+        bool pipelined = false;
+        if (ret > 0)
+            m_write_inline += count;
+        if (ret < 0 || !finish_batch(pipelined)) {
+            close_conn();
+            return;
+        }
+        // 读缓冲区中还有流水线请求，继续处理下一批
+        if (!pipelined)
+            return;
+    }
+}
+
+// 处理读缓冲区中的完整请求，返回本批生成的响应数。
+// 在数据库线程池中继续时，本批包括转交前已生成的响应，数量上限对整批计算
+int http_conn::build_batch() {
+    int count = m_db_pending ? m_batch_count : 0;
+    int start = count;
+    m_pipelined = false;
+    while (true) {
+        // 数据库线程池中继续处理上次停下的请求，不再重新解析
+        HTTP_CODE read_ret;
+        if (m_db_pending) {
+            m_db_pending = false;
+            read_ret = do_request();
+        } else {
+            read_ret = process_read();
+        }
+        // NO_REQUEST，表示请求不完整，需要继续接收请求数据
+        if (read_ret == NO_REQUEST)
+            break;
+        // 本批已生成的响应暂不发送，连同这个请求的响应由数据库线程池生成后一起发送
+        if (read_ret == DB_REQUEST) {
+            m_db_pending = true;
+            m_batch_count = count;
+            break;
+        }
+        // 连接上的请求数达到上限时，本响应带Connection: close，发完后关闭连接
+        if (m_max_requests > 0 && m_requests + 1 >= m_max_requests)
+            m_linger = false;
+        // 调用process_write完成报文响应，失败时撤销本响应已写入的部分
+        size_t iv_count = m_iv.size();
+        size_t iv_len = iv_count ? m_iv.back().iov_len : 0;
+        int to_send = bytes_to_send;
+        char *out = m_out;
+        int write_idx = m_write_idx;
+        bool write_ret = process_write(read_ret);
+        if (!write_ret) {
+            // 本批中此前的响应照常发出，发完后关闭连接
+            m_iv.resize(iv_count);
+            if (iv_count)
+                m_iv.back().iov_len = iv_len;
+            bytes_to_send = to_send;
+            if (m_out == out)
+                m_write_idx = write_idx;
+            m_out_start = m_write_idx;
+            m_keep_alive = false;
+            if (0 == count)
+                close_conn();
+            break;
+        }
+        ++count;
+        ++m_requests;
+        m_keep_alive = m_linger;
+        next_request();
+        // 短连接不再处理之后的请求
+        if (!m_keep_alive)
+            break;
+        // sendfile发送的文件只能是本批最后一个响应，数量或已映射的文件达到上限时同样结束本批，
+        // 剩余请求在本批发完后继续处理
+        if (m_file_fd >= 0 || count >= MAX_PIPELINE || m_map_count >= MAX_PIPELINE) {
+            m_pipelined = m_read_idx > 0;
+            break;
+        }
     }
-    // 调用process_write完成报文响应
-    bool write_ret = process_write(read_ret);
-    if (!write_ret) {
-        close_conn();
+    // 除连接上的第一个请求外，本批请求都复用了已有连接; 转交前的响应已在上次计入
+    int added = count - start;
+    if (added > 0) {
+        m_request_total += added;
+        m_request_reused += (m_requests == added) ? added - 1 : added;
     }
-    // 注册并监听写事件
-    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
-}
\ No newline at end of file
+    return count;
+}
@@ -19,12 +19,18 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <limits.h>
 #include <map>
+#include <vector>
+#include <atomic>
 
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "block_pool.h"
+#include "conn_lru.h"
 
 // http连接处理类
 // 根据状态转移,通过主从状态机封装了http连接类。
@@ -35,8 +41,10 @@
 class http_conn {
 public:
     static const int FILENAME_LEN = 200;        // 设置读取文件的名称m_real_file大小
-    static const int READ_BUFFER_SIZE = 2048;   // 设置读缓冲区m_read_buf大小
-    static const int WRITE_BUFFER_SIZE = 1024;  // 设置写缓冲区m_write_buf大小
+    static const int READ_BUFFER_SIZE = 2048;   // 连接内置读缓冲区大小，更大的请求换用堆上的缓冲区
+    static const int READ_SPILL_SIZE = 65536;   // read_once在栈上的溢出区大小，读缓冲区不够时由readv读入这里
+    static const int WRITE_BUFFER_SIZE = 1024;  // 连接内置写缓冲区m_write_buf大小，写满后续写在block_pool的块中
+    static const int MAX_PIPELINE = 16;         // 一批最多合并发送的流水线请求数
 
     enum METHOD {    // 报文的请求方法，本项目只用到GET和POST
         GET = 0,
@@ -64,7 +72,10 @@ public:
         FORBIDDEN_REQUEST,            // 请求资源禁止访问，没有读取权限; 跳转process_write完成响应报文
         FILE_REQUEST,                 // 请求资源可以正常访问; 跳转process_write完成响应报文
         INTERNAL_ERROR,               // 服务器内部错误，该结果在主状态机逻辑switch的default下，一般不会触发
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        HEADER_TOO_LARGE,             // 请求行和请求头超过m_header_limit; 跳转process_write返回431后关闭连接
+        BODY_TOO_LARGE,               // 消息体超过m_body_limit; 跳转process_write返回413后关闭连接
+        DB_REQUEST                    // 登录、注册等需要数据库的请求，当前线程未持有数据库连接; 交给数据库线程池继续处理
     };
 
     enum LINE_STATUS {                // 从状态机的状态
@@ -74,34 +85,102 @@ public:
     };
 
 public:
-    http_conn() {}
-    ~http_conn() {}
+    http_conn() : m_lru(NULL), m_lru_prev(NULL), m_lru_next(NULL),
+                  m_gen(1), m_read_buf(m_read_local), m_read_size(READ_BUFFER_SIZE),
+                  m_file_address(0), m_file_fd(-1), m_map_count(0) {}
+    ~http_conn() {
+        if (m_read_buf != m_read_local)
+            free(m_read_buf);
+    }
 
 public:
     void init(int sockfd,
+              int epollfd,
               const sockaddr_in &addr, 
               char *, 
               int, 
               int, 
+              int send_mode,
+              bool one_shot,
               string user, 
               string passwd, 
               string sqlname);
     void close_conn(bool real_close = true);
     void process();
     bool read_once();   // 循环读取客户数据，直到无数据可读或对方关闭连接
-    bool write();
+    // pipelined为true表示这批响应已发完且读缓冲区中还有流水线请求，事件未重置，调用者需继续process
+    bool write(bool &pipelined);
     sockaddr_in *get_address() {
         return &m_address;
     }
     void initmysql_result(connection_pool *connPool);
-    int timer_flag;
-    int improv;
+    int timer_flag;     // reactor模式下工作线程读写失败，请求事件循环关闭连接
+
+    // 连接归属: 连接平时归所属reactor，放入请求队列后归工作线程，经完成队列交还后再归reactor。
+    // 工作线程不修改epoll，归属工作线程期间到达的事件由reactor暂存，交还时一并处理，
+    // 注册的事件只在读写关注确实变化时修改。以下成员只由所属reactor线程读写
+    // LT模式的reactor由工作线程读取，数据读走之前就绪状态会被反复报告，这时连接仍以EPOLLONESHOT注册，
+    // 由内核在报告事件后暂停通知，交还时恢复
+    bool m_one_shot;
+    bool m_busy;        // 连接正由工作线程处理
+    int m_deferred;     // 工作线程处理期间到达、推迟到交还后处理的事件
+    int m_interest;     // 当前在epoll中注册的读写事件，0表示已暂停通知
+    void set_interest(int ev);
+    bool has_unread() const { return m_unread; }  // ET模式下因读缓冲区满停止读取，socket中可能还有数据
+    conn_lru *m_lru;            // 空闲时所在的LRU链表，不空闲时为NULL
+    http_conn *m_lru_prev;
+    http_conn *m_lru_next;
+
+    // io_uring后端: 收发由ring线程提交，http_conn只维护缓冲区与发送进度
+    bool fill_read(const char *data, int len);  // 将ring收到的数据追加到m_read_buf
+    int read_space() const { return read_limit() - m_read_idx; }
+    // 一次最多取IOV_MAX项，其余部分在下次发送时取
+    struct iovec *get_iovec(int *count) {
+        *count = (int)m_iv.size() - m_iv_idx;
+        if (*count > IOV_MAX)
+            *count = IOV_MAX;
+        return &m_iv[0] + m_iv_idx;
+    }
+    int pending_bytes() const { return bytes_to_send; }
+    int advance(int bytes);                     // 记录已发送字节，返回剩余字节数
+    bool is_linger() const { return m_keep_alive; }
+    // 长连接已处理过请求、响应已发完且没有未处理的请求数据，正在等待下一个请求
+    bool is_idle() const { return m_requests > 0 && 0 == m_read_idx && 0 == bytes_to_send; }
+    bool is_pipelined() const { return m_pipelined; }  // 发送完成后读缓冲区中是否还有待处理的请求
+    bool db_pending() const { return m_db_pending; }   // 本批停在需要数据库的请求上，等待数据库线程池继续处理
+    // 请求头已解析完，正在接收消息体；body_received为已收到的消息体字节数
+    bool in_body() const { return CHECK_STATE_CONTENT == m_check_state; }
+    int body_received() const { return m_read_idx - m_checked_idx; }
+    unsigned requests() const { return m_requests; }
+    bool is_closed() const { return m_sockfd == -1; }
+    int get_fd() const { return m_fd; }         // close_conn后仍保留，供完成队列找回连接
+
+    // 连接句柄: 低48位为对象地址，高16位为连接代数，epoll_event.data.u64和完成队列中保存的都是句柄。
+    // 连接关闭回收时代数加1，此前发出的句柄全部失效，过期的事件和完成通知在O(1)内被丢弃。
+    // 非零的代数使句柄总是不小于2^48，与直接存放fd的监听socket、eventfd等区分开
+    uint64_t handle() const { return ((uint64_t)m_gen << 48) | (uint64_t)(uintptr_t)this; }
+    static bool is_handle(uint64_t data) { return (data >> 48) != 0; }
+    // 句柄已过期时返回NULL，对象由conn_slab延迟释放，过期句柄指向的内存仍然有效
+    static http_conn *from_handle(uint64_t data) {
+        http_conn *conn = (http_conn *)(uintptr_t)(data & ((1ULL << 48) - 1));
+        return conn->m_gen == (unsigned short)(data >> 48) ? conn : NULL;
+    }
+    void next_gen() {
+        if (0 == ++m_gen)
+            m_gen = 1;
+    }
+    client_data timer_data;                     // 定时器使用的连接资源
+    void unmap();                               // 释放文件映射、关闭文件并归还输出块，发送结束、失败或连接回收时调用
 
 private:
     void init();
+    // 一个请求的响应生成后，把读缓冲区中剩余的流水线数据移到开头并重置解析状态
+    void next_request();
+    // 一批响应发送完毕后重置发送状态，读缓冲区中的流水线请求保留
+    void next_batch();
     // 从m_read_buf读取，并处理请求报文
     HTTP_CODE process_read();
-    // 向m_write_buf写入响应报文数据
+    // 向输出缓冲区写入响应报文数据
     bool process_write(HTTP_CODE ret);
     // 主状态机解析报文中的请求行数据
     HTTP_CODE parse_request_line(char *text);
@@ -120,10 +199,36 @@ private:
 
     // 从状态机读取一行，分析是请求报文的哪一部分
     LINE_STATUS parse_line();
-    void unmap();
+    // 读缓冲区最多扩容到请求头与消息体上限之和
+    static int read_limit() { return m_header_limit + m_body_limit; }
+    // 读缓冲区扩容到至少need字节，已解析出的指向缓冲区的指针随之移动
+    bool grow_read(int need);
+    // 请求处理完后剩余数据放得下时换回内置缓冲区，释放堆上的缓冲区
+    void shrink_read();
+    // readv读取一次，读缓冲区不够时经spill扩容，返回值与recv相同
+    int recv_spill(char *spill);
+    // 发送bytes字节后，调整iovec的指针和长度
+    void update_iovec(int bytes);
+    // 向本批响应追加一段数据，与上一段在内存中相连时合并为一个iovec
+    void add_iovec(char *base, int len);
+    // 把当前块中尚未加入iovec的数据加入本批
+    void flush_block();
+    // 当前块剩余空间不足时换用至少need字节的新块
+    bool next_block(int need);
+    // 归还本批用到的输出块，换回m_write_buf
+    void release_blocks();
+    // sendfile模式下发送一次响应头或文件内容
+    int sendfile_once();
+    // 处理读缓冲区中的完整请求，生成一批响应
+    int build_batch();
+    // 发送本批响应，不修改epoll事件
+    int send_batch();
+    // 本批全部发出后的收尾，短连接返回false
+    bool finish_batch(bool &pipelined);
 
     //根据响应报文格式，生成对应8个部分，以下函数均由do_request调用
     bool add_response(const char *format, ...);
+    bool add_data(const char *data, int len);   // 不经格式化直接追加
     bool add_content(const char *content);
     bool add_status_line(int status, const char *title);
     bool add_headers(int content_length);
@@ -133,21 +238,42 @@ private:
     bool add_blank_line();
 
 public:
-    static int m_epollfd;
-    static int m_user_count;
+    static std::atomic<int> m_user_count;   // 各reactor共享的连接总数
+    static int m_header_limit;              // 请求行和请求头的最大字节数，超过返回431
+    static int m_body_limit;                // 消息体的最大字节数，超过返回413
+    static std::atomic<unsigned long> m_write_total;    // 工作线程生成并尝试直接发送的响应数
+    static std::atomic<unsigned long> m_write_inline;   // 其中由工作线程直接发送完毕、无需注册写事件的响应数
+    static int m_max_requests;              // 每个连接最多处理的请求数，0为不限制
+    static std::atomic<unsigned long> m_request_total;  // 已生成响应的请求数
+    static std::atomic<unsigned long> m_request_reused; // 其中不是连接上第一个请求、省去了一次TCP握手的请求数
+    int m_epollfd;                          // 连接所属reactor的epoll实例
     MYSQL* mysql;
     int m_state;  // 读为0, 写为1
 
 private:
     int m_sockfd;
+    int m_fd;                            // 连接绑定的fd，关闭后不清除
+    unsigned short m_gen;                // 连接代数，对象每次被回收时加1
     sockaddr_in m_address;
-    char m_read_buf[READ_BUFFER_SIZE];   // 存储读取的请求报文数据
+    char *m_read_buf;                    // 存储读取的请求报文数据，平时指向m_read_local，大请求时指向堆上的缓冲区
+    int m_read_size;                     // m_read_buf的容量，分配时多出的一字节留给消息体结尾的\0
+    char m_read_local[READ_BUFFER_SIZE + 1];
     int m_read_idx;                      // 缓冲区中m_read_buf中数据的最后一个字节的下一个位置
     int m_checked_idx;                   // m_read_buf读取的位置m_checked_idx
     int m_start_line;                    // m_read_buf中已经解析的字符个数
 
-    char m_write_buf[WRITE_BUFFER_SIZE]; // 存储发出的响应报文数据
-    int m_write_idx;                     // 指示buffer中的长度
+    // 输出缓冲区: 先写m_write_buf，写满后依次写入从block_pool取得的块，
+    // 每个块中的数据和映射的文件作为iovec串成一条链，整批用writev发出
+    char m_write_buf[WRITE_BUFFER_SIZE]; // 连接内置的第一个块，小响应不需要额外的块
+    char *m_out;                         // 当前正在写入的块
+    int m_out_size;                      // 当前块的大小
+    int m_write_idx;                     // 当前块中已写入的长度
+    int m_out_start;                     // 当前块中尚未加入iovec的数据的起始位置
+    struct out_block {
+        char *base;
+        int size;
+    };
+    std::vector<out_block> m_blocks;     // 本批从block_pool取得的块
 
     CHECK_STATE m_check_state;           // 主状态机的状态
     METHOD m_method;                     // 请求方法
@@ -160,20 +286,35 @@ private:
     char *m_host;                        // 主机名
     int  m_content_length;               // HTTP请求的消息总长度
     bool m_linger;                       // HTTP请求是否要求保持连接
+    bool m_keep_alive;                   // 本批最后一个响应发完后是否保持连接
+    int m_requests;                      // 连接上已生成响应的请求数
+    bool m_pipelined;                    // 本批因数量或缓冲区限制结束，读缓冲区中还有未处理的请求
+    bool m_db_pending;                   // 已解析完的请求需要数据库，do_request在持有数据库连接的线程中重新执行
+    int m_batch_count;                   // 转交数据库线程池时本批已生成、尚未发送的响应数
+    bool m_unread;                       // ET模式下上次读取因缓冲区满而停止
+    char m_body_tail;                    // 消息体之后被\0覆盖的字节，属于下一个流水线请求
  
     char   *m_file_address;              // 读取服务器上的文件地址
+    int    m_file_fd;                    // sendfile模式下打开的文件
+    off_t  m_file_offset;                // sendfile模式下文件的发送进度
     struct stat m_file_stat;             // 目标文件的状态。通过它可以判断文件是否存在、是否为目录、是否可读，获取文件大小等信息
-    struct iovec m_iv[2];                // io向量机制iovec
-    int m_iv_count; 
+    struct file_map {
+        char *address;
+        off_t size;
+    };
+    file_map m_maps[MAX_PIPELINE];       // 本批响应中已映射的文件，发送完毕后统一释放
+    int m_map_count;
+    std::vector<struct iovec> m_iv;      // io向量机制iovec，本批响应的各段数据依次排列
+    int m_iv_idx;                        // 第一个尚未发完的iovec
     int cgi;                             // 是否启用的POST
     char *m_string;                      // 存储请求头数据
     int bytes_to_send;                   // 剩余发送字节数
     int bytes_have_send;                 // 已发送字节数    
     char *doc_root; 
 
-    map<string, string> m_users;
     int m_TRIGMode;
     int m_close_log;
+    int m_send_mode;                     // 静态文件发送方式: 0 mmap+writev, 1 sendfile
 
     char sql_user[100];
     char sql_passwd[100];
@@ -9,6 +9,7 @@
 #include <exception>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
 class sem {
 public:
     sem() {
@@ -30,6 +31,18 @@ public:
         // sem_wait: 将以原子操作方式将信号量减一,信号量为0时,sem_wait阻塞
         return sem_wait(&m_sem) == 0;
     }
+    bool wait(int timeout_ms) {
+        // sem_timedwait: 与sem_wait相同，但最多阻塞到CLOCK_REALTIME的绝对时间abs_timeout
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += timeout_ms / 1000;
+        ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec += 1;
+            ts.tv_nsec -= 1000000000;
+        }
+        return sem_timedwait(&m_sem, &ts) == 0;
+    }
     bool post() {
         // sem_post: 以原子操作方式将信号量加1,信号量大于0时,唤醒调用sem_post的线程
         return sem_post(&m_sem) == 0;
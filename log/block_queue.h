@@ -145,6 +145,20 @@ public:
         return true;
     }
 
+    //不等待，队列为空时直接返回false
+    bool try_pop(T &item) {
+        m_mutex.lock();
+        if (m_size <= 0) {
+            m_mutex.unlock();
+            return false;
+        }
+        m_front = (m_front + 1) % m_max_size;
+        item = m_array[m_front];
+        m_size--;
+        m_mutex.unlock();
+        return true;
+    }
+
     //增加了超时处理在项目中没有使用到
     //在pthread_cond_wait基础上增加了等待的时间，只指定时间内能抢到互斥锁即可
     //其他逻辑不变
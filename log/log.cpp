@@ -3,14 +3,36 @@
 #include <sys/time.h>
 #include <stdarg.h>
 #include "log.h"
+#include "../timer/cached_clock.h"
+#include "../threadpool/executor.h"
 #include <pthread.h>
 using namespace std;
 
 Log::Log() {
     m_count = 0;
     m_is_async = false;
+    m_flushing = false;
+    m_executor = NULL;
 }
 
+// 写日志任务: 线程池析构或放入失败时任务未执行就被析构，由析构的线程写入，不丢下队列中的日志
+struct Log::drain {
+    explicit drain(Log *log) : m_log(log) {}
+    drain(drain &&other) noexcept : m_log(other.m_log) {
+        other.m_log = NULL;
+    }
+    ~drain() {
+        if (m_log)
+            m_log->async_write_log();
+    }
+    void operator()() {
+        Log *log = m_log;
+        m_log = NULL;
+        log->async_write_log();
+    }
+    Log *m_log;
+};
+
 Log::~Log() {
     if (m_fp != NULL) {
         fclose(m_fp);
@@ -26,11 +48,8 @@ bool Log::init(const char *file_name,
     if (max_queue_size >= 1) {
         //设置写入方式flag
         m_is_async = true;
-        //创建并设置阻塞队列长度
+        //创建并设置阻塞队列长度，队列中的日志由执行器的任务写入文件
         m_log_queue = new block_queue<string>(max_queue_size);
-        pthread_t tid;
-        //flush_log_thread为回调函数,这里表示创建线程异步写日志
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
     }
     
     m_close_log = close_log;
@@ -87,11 +106,11 @@ bool Log::init(const char *file_name,
 
 void Log::write_log(int level, const char *format, ...)
 {
-    struct timeval now = {0, 0};
-    gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
+    //使用事件循环缓存的时间和预先格式化好的时间前缀，不再每行调用gettimeofday和localtime
+    cached_clock *clock = cached_clock::get_instance();
+    const cached_clock::slot *now = clock->now();
+    int msec = clock->wall_ms();
+    const struct tm &my_tm = now->local;
     char s[16] = {0};
      //日志分级
     switch (level) {
@@ -153,12 +172,14 @@ void Log::write_log(int level, const char *format, ...)
 
     //写入内容格式：时间 + 内容
     //时间格式化，snprintf成功返回写字符的总数，其中不包括结尾的null字符
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
+    //前缀长度上限为时间串加上毫秒、日志级别和分隔符
+    int n = snprintf(m_buf, sizeof(now->log_time) + 32, "%s.%03d %s ", now->log_time, msec, s);
     
     //内容格式化，用于向字符串中打印数据、数据格式用户自定义，返回写入到字符数组str中的字符个数(不包含终止符)
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
+    int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valst);
+    //内容超长时被截断，m为截断后实际写入的长度
+    if (m > m_log_buf_size - n - 2)
+        m = m_log_buf_size - n - 2;
     m_buf[n + m] = '\n';
     m_buf[n + m + 1] = '\0';
     log_str = m_buf;
@@ -167,8 +188,18 @@ void Log::write_log(int level, const char *format, ...)
 
     //若m_is_async为true表示异步，默认为同步
     //若异步,则将日志信息加入阻塞队列,同步则加锁向文件中写
+    //异步时没有写日志的任务在执行就放入线程池，未设置线程池时由当前线程写入
     if (m_is_async && !m_log_queue->full()) {
         m_log_queue->push(log_str);
+        if (!m_flushing.exchange(true)) {
+            m_exec_lock.lock();
+            executor *exec = m_executor;
+            if (exec)
+                exec->execute(task(drain(this)), PRIO_LOW);
+            m_exec_lock.unlock();
+            if (!exec)
+                async_write_log();
+        }
     } else {
         m_mutex.lock();
         fputs(log_str.c_str(), m_fp);
@@ -178,6 +209,12 @@ void Log::write_log(int level, const char *format, ...)
     va_end(valst);
 }
 
+void Log::set_executor(executor *exec) {
+    m_exec_lock.lock();
+    m_executor = exec;
+    m_exec_lock.unlock();
+}
+
 void Log::flush(void) {
     m_mutex.lock();
     //强制刷新写入流缓冲区
@@ -14,10 +14,13 @@
 #include <string>
 #include <stdarg.h>
 #include <pthread.h>
+#include <atomic>
 #include "block_queue.h"
 
 using namespace std;
 
+class executor;
+
 class Log {
 public:
     //C++11以后,使用局部变量懒汉不用加锁
@@ -25,10 +28,6 @@ public:
         static Log instance;
         return &instance;
     }
-    //异步写日志公有方法，调用私有方法async_write_log
-    static void *flush_log_thread(void *args) {
-        Log::get_instance()->async_write_log();  
-    }
     // init函数实现日志创建、写入方式的判断。
     // 可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
     bool init(const char *file_name, 
@@ -41,23 +40,31 @@ public:
     void write_log(int level, const char *format, ...);
     //强制刷新缓冲区
     void flush(void);
+    //设置执行异步写日志任务的线程池，NULL时由写日志的线程写入。返回后不会再向原线程池放入任务
+    void set_executor(executor *exec);
 
 private:
+    struct drain;
     Log();
     virtual ~Log();
-    //异步写日志方法
-    void* async_write_log() {
+    //异步写日志方法: 作为线程池的低优先级任务运行，写完队列中的日志后返回，不占用专门的线程
+    void async_write_log() {
         string single_log;
-        //从阻塞队列中取出一个日志string，写入文件
-        while (m_log_queue->pop(single_log)) {
-            m_mutex.lock();
-            // int fputs(const char *str, FILE *stream);
-            // str，一个数组，包含了要写入的以空字符终止的字符序列。
-            // stream，指向FILE对象的指针，该FILE对象标识了要被写入字符串的流。
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
+        while (true) {
+            //从阻塞队列中取出一个日志string，写入文件
+            while (m_log_queue->try_pop(single_log)) {
+                m_mutex.lock();
+                // int fputs(const char *str, FILE *stream);
+                // str，一个数组，包含了要写入的以空字符终止的字符序列。
+                // stream，指向FILE对象的指针，该FILE对象标识了要被写入字符串的流。
+                fputs(single_log.c_str(), m_fp);
+                m_mutex.unlock();
+            }
+            //清除标志后再检查一次，期间放入的日志要么由这里写入，要么由放入者提交新的任务
+            m_flushing = false;
+            if (m_log_queue->empty() || m_flushing.exchange(true))
+                return;
         }
-
     }
 
 private:
@@ -71,6 +78,9 @@ private:
     char *m_buf;
     block_queue<string> *m_log_queue;   // 阻塞队列
     bool m_is_async;                    // 是否同步标志位
+    std::atomic<bool> m_flushing;       // 是否已有写日志的任务在线程池中，同一时刻只有一个，日志按顺序写入
+    executor *m_executor;               // 执行写日志任务的线程池
+    locker m_exec_lock;                 // 保护m_executor，放入任务期间持有
     locker m_mutex;
     int m_close_log;                    // 关闭日志
 };
@@ -24,7 +24,24 @@ int main(int argc, char *argv[])
                 config.sql_num,
                 config.thread_num, 
                 config.close_log,
-                config.actor_model);
+                config.actor_model,
+                config.reactor_num,
+                config.backlog,
+                config.accept_budget,
+                config.defer_accept,
+                config.fastopen,
+                config.send_mode,
+                config.header_limit,
+                config.body_limit,
+                config.keepalive_timeout,
+                config.max_requests,
+                config.idle_high_water,
+                config.header_timeout,
+                config.body_timeout,
+                config.body_rate,
+                config.write_timeout,
+                config.sched,
+                config.thread_max);
     
 
     //日志
@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+# 流水线回归测试: 一整批GET中间夹一个需要数据库的POST，数据库线程池继续处理时
+# 整批的响应数和已映射的文件数不能超过MAX_PIPELINE。
+# 用法: 先启动服务器，再运行 python3 pipeline_db.py [端口] [轮数]
+import socket
+import sys
+
+port = int(sys.argv[1]) if len(sys.argv) > 1 else 9006
+rounds = int(sys.argv[2]) if len(sys.argv) > 2 else 20
+
+GET = b"GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+BODY = b"user=pipeline&password=pipeline"
+POST = (b"POST /2CGISQL.cgi HTTP/1.1\r\nHost: localhost\r\nContent-Length: %d\r\n\r\n" % len(BODY)) + BODY
+
+
+def count_responses(sock, expect):
+    # 按Content-Length逐个切分响应，连接被关闭时返回已收到的个数
+    data = b""
+    got = 0
+    while got < expect:
+        head_end = data.find(b"\r\n\r\n")
+        if head_end < 0:
+            chunk = sock.recv(65536)
+            if not chunk:
+                break
+            data += chunk
+            continue
+        length = 0
+        for line in data[:head_end].split(b"\r\n")[1:]:
+            name, _, value = line.partition(b":")
+            if name.strip().lower() == b"content-length":
+                length = int(value)
+        total = head_end + 4 + length
+        while len(data) < total:
+            chunk = sock.recv(65536)
+            if not chunk:
+                return got
+            data += chunk
+        data = data[total:]
+        got += 1
+    return got
+
+
+def main():
+    # 15个GET之后是数据库请求，再接16个GET，一次写入
+    payload = GET * 15 + POST + GET * 16
+    expect = 32
+    for i in range(rounds):
+        sock = socket.create_connection(("127.0.0.1", port), timeout=10)
+        sock.sendall(payload)
+        got = count_responses(sock, expect)
+        sock.close()
+        if got != expect:
+            print("round %d: %d of %d responses" % (i, got, expect))
+            return 1
+    print("ok: %d rounds, %d responses each" % (rounds, expect))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,98 @@
+// 请求队列微基准: 比较locked_queue与各调度方式下的mpmc_queue
+// 用法: make queue_bench && ./queue_bench [每个生产者放入的任务数]
+// 生产者模拟事件循环逐个或成批放入任务，消费者模拟工作线程取出并执行，任务与http请求一样是两个指针
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "../threadpool/work_queue.h"
+
+struct counter {
+    std::atomic<long long> *sum;
+    long long v;
+    void operator()() { sum->fetch_add(v, std::memory_order_relaxed); }
+};
+
+static const int BATCH = 8;     // 成批放入时每批的任务数
+
+// 返回每秒完成的任务数(千)，结果不一致时返回-1
+template <typename Q>
+static double run(int sched, int producers, int consumers, long per, bool batch) {
+    Q q(10000, consumers, sched);
+    std::atomic<long long> sum(0);
+    std::vector<std::thread> workers, feeders;
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < consumers; ++c) {
+        workers.emplace_back([&q, c] {
+            task t;
+            long long stamp;
+            while (q.pop(c, t, stamp, 0))
+                t();
+        });
+    }
+    for (int p = 0; p < producers; ++p) {
+        feeders.emplace_back([&q, &sum, p, per, batch] {
+            task jobs[BATCH];
+            size_t keys[BATCH];
+            long k = 0;
+            while (k < per) {
+                int n = 0;
+                for (; n < (batch ? BATCH : 1) && k + n < per; ++n) {
+                    counter job = {&sum, k + n};
+                    jobs[n] = task(job);
+                    keys[n] = (size_t)(p * per + k + n);
+                }
+                // 队列满时让出CPU后重试
+                int pushed = 0;
+                while (pushed < n) {
+                    int got = batch ? q.push_batch(jobs + pushed, keys + pushed, n - pushed, 0)
+                                    : (q.push(jobs[0], keys[0], PRIO_NORMAL, 0) ? 1 : 0);
+                    if (0 == got)
+                        std::this_thread::yield();
+                    pushed += got;
+                }
+                k += n;
+            }
+        });
+    }
+    for (size_t i = 0; i < feeders.size(); ++i)
+        feeders[i].join();
+    long long expect = (long long)producers * per * (per - 1) / 2;
+    while (sum.load() != expect) {
+        if (sum.load() > expect)
+            break;
+        std::this_thread::yield();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    q.close(consumers);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    if (sum.load() != expect)
+        return -1;
+    return producers * per / seconds / 1000;
+}
+
+int main(int argc, char *argv[]) {
+    long per = argc > 1 ? atol(argv[1]) : 200000;
+    const char *names[] = {"shared", "round-robin", "hash", "affinity"};
+    int shapes[][2] = {{1, 4}, {1, 16}, {4, 16}, {4, 32}};
+    printf("cpus %u, %ld tasks per producer, kops/s\n", std::thread::hardware_concurrency(), per);
+    printf("%-8s %-6s %10s", "p x c", "push", "locked");
+    for (int s = 0; s < 4; ++s)
+        printf(" %12s", names[s]);
+    printf("\n");
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); ++i) {
+        for (int batch = 0; batch < 2; ++batch) {
+            char shape[16];
+            snprintf(shape, sizeof(shape), "%dx%d", shapes[i][0], shapes[i][1]);
+            printf("%-8s %-6s %10.0f", shape, batch ? "batch" : "single",
+                   run<locked_queue<task> >(0, shapes[i][0], shapes[i][1], per, batch));
+            for (int s = 0; s < 4; ++s)
+                printf(" %12.0f", run<mpmc_queue<task> >(s, shapes[i][0], shapes[i][1], per, batch));
+            printf("\n");
+        }
+    }
+    return 0;
+}
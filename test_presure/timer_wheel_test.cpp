@@ -0,0 +1,70 @@
+// 时间轮单元测试: make timer_test && ./timer_test
+#include <cassert>
+#include <cstdio>
+#include "../timer/lst_timer.h"
+
+static int fired = 0;
+static long long fired_at = 0;
+static long long now_ms = 0;
+
+static void on_expire(client_data *) {
+    ++fired;
+    fired_at = now_ms;
+}
+
+static void add(time_wheel &wheel, client_data *data, long long expire) {
+    data->node.expire = expire;
+    data->node.cb_func = on_expire;
+    data->node.user_data = data;
+    data->node.phase = PHASE_HEADER;
+    wheel.add_timer(&data->node);
+}
+
+// 逐毫秒推进，记录回调执行时的时刻
+static void run_until(time_wheel &wheel, long long to) {
+    while (now_ms < to)
+        wheel.tick(++now_ms);
+}
+
+// tick停在第一层边界上时，该边界尚未级联，next_expire应返回该边界
+static void test_boundary_cascade() {
+    now_ms = 1000;
+    time_wheel wheel(now_ms);
+    client_data data;
+    add(wheel, &data, 1324);    // 距现在超过256毫秒，放入上层第5个槽位
+
+    wheel.tick(1279);           // m_now停在1280，正好是第一层边界
+    now_ms = 1279;
+    assert(0 == fired);
+    assert(1280 == wheel.next_expire());
+
+    wheel.tick(1280);           // 级联到第一层
+    now_ms = 1280;
+    assert(1324 == wheel.next_expire());
+    run_until(wheel, 1324);
+    assert(1 == fired && 1324 == fired_at);
+    assert(-1 == wheel.next_expire());
+}
+
+// 定时器远于第一层时，next_expire返回第一次级联的时刻，每次级联后逐步逼近超时时间
+static void test_far_timer() {
+    fired = 0;
+    now_ms = 5;
+    time_wheel wheel(now_ms);
+    client_data data;
+    add(wheel, &data, 70000);   // 第二层
+    long long t;
+    while ((t = wheel.next_expire()) >= 0 && 0 == fired) {
+        assert(t <= 70000);
+        now_ms = t;
+        wheel.tick(t);
+    }
+    assert(1 == fired && 70000 == fired_at);
+}
+
+int main() {
+    test_boundary_cascade();
+    test_far_timer();
+    printf("timer wheel: ok\n");
+    return 0;
+}
@@ -0,0 +1,159 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+/**
+ * 线程池执行的任务与执行器接口
+ * > * task: 类型擦除的只可移动的可调用对象，捕获不超过INLINE_SIZE字节时存放在对象内部，不分配堆内存。
+ *     线程池的请求队列直接存放task，http请求和异步日志写入等后台任务在同一组工作线程上执行
+ * > * 任务分三个优先级，工作线程先取高优先级的任务，http请求为普通优先级
+ * > * executor: 线程池实现的接口，execute放入任务后立即返回; submit返回std::future，可等待任务的返回值或异常
+ **/
+#include <future>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <stddef.h>
+
+class task {
+public:
+    static const size_t INLINE_SIZE = 64;   // 内部存放的可调用对象的最大字节数
+
+    task() : m_ops(NULL) {}
+
+    template <typename F, typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<F>::type, task>::value>::type>
+    task(F &&f) : m_ops(NULL) {
+        typedef typename std::decay<F>::type D;
+        construct<D>(std::forward<F>(f), fits_inline<D>());
+    }
+
+    task(task &&other) : m_ops(other.m_ops) {
+        if (m_ops) {
+            m_ops->move(m_buf, other.m_buf);
+            other.m_ops = NULL;
+        }
+    }
+
+    task &operator=(task &&other) {
+        if (this != &other) {
+            reset();
+            m_ops = other.m_ops;
+            if (m_ops) {
+                m_ops->move(m_buf, other.m_buf);
+                other.m_ops = NULL;
+            }
+        }
+        return *this;
+    }
+
+    ~task() {
+        reset();
+    }
+
+    void operator()() {
+        m_ops->invoke(m_buf);
+    }
+
+    explicit operator bool() const {
+        return m_ops != NULL;
+    }
+
+    // 可调用对象是否存放在内部
+    bool is_inline() const {
+        return m_ops && m_ops->inline_storage;
+    }
+
+private:
+    task(const task &);
+    task &operator=(const task &);
+
+    // 过大、对齐要求过高或移动时可能抛出异常的可调用对象放在堆上，对象内部只存放指针
+    template <typename D>
+    struct fits_inline : std::integral_constant<bool, sizeof(D) <= INLINE_SIZE &&
+                                                      alignof(D) <= alignof(max_align_t) &&
+                                                      std::is_nothrow_move_constructible<D>::value> {};
+
+    template <typename D, typename F>
+    void construct(F &&f, std::true_type) {
+        new (m_buf) D(std::forward<F>(f));
+        m_ops = &inline_ops<D>::ops;
+    }
+
+    template <typename D, typename F>
+    void construct(F &&f, std::false_type) {
+        *(D **)m_buf = new D(std::forward<F>(f));
+        m_ops = &heap_ops<D>::ops;
+    }
+
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(m_buf);
+            m_ops = NULL;
+        }
+    }
+
+    // 每种可调用对象类型一张函数表，move把对象从src移到dst并析构src中的对象
+    struct vtable {
+        void (*invoke)(void *buf);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *buf);
+        bool inline_storage;
+    };
+
+    template <typename D>
+    struct inline_ops {
+        static void invoke(void *buf) { (*(D *)buf)(); }
+        static void move(void *dst, void *src) {
+            new (dst) D(std::move(*(D *)src));
+            ((D *)src)->~D();
+        }
+        static void destroy(void *buf) { ((D *)buf)->~D(); }
+        static const vtable ops;
+    };
+
+    template <typename D>
+    struct heap_ops {
+        static void invoke(void *buf) { (**(D **)buf)(); }
+        static void move(void *dst, void *src) { *(D **)dst = *(D **)src; }
+        static void destroy(void *buf) { delete *(D **)buf; }
+        static const vtable ops;
+    };
+
+    alignas(max_align_t) unsigned char m_buf[INLINE_SIZE];
+    const vtable *m_ops;
+};
+
+template <typename D>
+const task::vtable task::inline_ops<D>::ops = {&inline_ops<D>::invoke, &inline_ops<D>::move, &inline_ops<D>::destroy, true};
+template <typename D>
+const task::vtable task::heap_ops<D>::ops = {&heap_ops<D>::invoke, &heap_ops<D>::move, &heap_ops<D>::destroy, false};
+
+// 任务优先级
+enum TASK_PRIORITY
+{
+    PRIO_HIGH = 0,
+    PRIO_NORMAL,
+    PRIO_LOW,
+    PRIO_NUM
+};
+
+// 任务执行器接口，由threadpool实现
+class executor {
+public:
+    virtual ~executor() {}
+
+    // 放入任务，已关闭或队列已满时返回false，任务随参数析构。任务不应抛出异常，需要时用submit
+    virtual bool execute(task t, int priority = PRIO_NORMAL) = 0;
+
+    // 放入任务并返回future; 任务被拒绝或未执行就被丢弃时future::get抛出broken_promise
+    template <typename F>
+    std::future<decltype(std::declval<F &>()())> submit(F &&f, int priority = PRIO_NORMAL) {
+        typedef decltype(std::declval<F &>()()) R;
+        std::packaged_task<R()> pt(std::forward<F>(f));
+        std::future<R> result = pt.get_future();
+        execute(task(std::move(pt)), priority);
+        return result;
+    }
+};
+
+#endif
@@ -7,169 +7,450 @@
  * > * 同步I/O模拟proactor模式
  * > * 半同步/半反应堆
  * > * 线程池
+ * > * 请求队列由模板参数Q选择，默认为无锁环形队列，见work_queue.h。队列中存放task，
+ *     http请求包装为普通优先级的task，其他模块通过execute放入后台任务(如异步日志写入)，见executor.h
+ * > * 线程数在最小值和最大值之间自动调整: 所有线程都在忙且任务排队超过GROW_WAIT毫秒时增加一个线程(入队和出队时检查)，
+ *     增加的线程空闲IDLE_TIMEOUT毫秒后退出; 析构时关闭队列并回收所有线程
+ * > * 静态文件线程池与数据库线程池分开: connPool为NULL的线程池不取数据库连接，
+ *     解析后需要数据库的请求转交set_db_pool设置的线程池，静态请求不会因数据库连接用尽而阻塞
  **/
-#include <list>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
 #include <exception>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "executor.h"
+#include "work_queue.h"
+// 进程可用的CPU数: CPU亲和性掩码中的CPU数，再受cgroup的CPU配额限制(cgroup v2的cpu.max或v1的cfs_quota_us)
+inline int effective_cpus() {
+    int cpus = 1;
+    cpu_set_t set;
+    if (0 == sched_getaffinity(0, sizeof(set), &set))
+        cpus = CPU_COUNT(&set);
+    long quota = -1, period = 0;
+    FILE *fp = fopen("/sys/fs/cgroup/cpu.max", "r");
+    if (fp) {
+        char buf[32];
+        // 格式为"配额 周期"，不限制时配额为max
+        if (2 != fscanf(fp, "%31s %ld", buf, &period) || 0 == strcmp(buf, "max"))
+            period = 0;
+        else
+            quota = atol(buf);
+        fclose(fp);
+    } else if ((fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r"))) {
+        if (1 != fscanf(fp, "%ld", &quota))
+            quota = -1;
+        fclose(fp);
+        if ((fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r"))) {
+            if (1 != fscanf(fp, "%ld", &period))
+                period = 0;
+            fclose(fp);
+        }
+    }
+    if (quota > 0 && period > 0) {
+        int limit = (int)((quota + period - 1) / period);
+        if (limit < cpus)
+            cpus = limit;
+    }
+    return cpus > 0 ? cpus : 1;
+}
+
 // 线程池类，将它定义为模板类是为了代码复用，模板参数T是任务类
 // 线程池的设计模式为半同步/半反应堆，其中反应堆具体为Proactor事件处理模式。
 // 具体的: 主线程为异步线程，负责监听文件描述符，接收socket新连接，
 // 若当前监听的socket发生了读写事件，然后将任务插入到请求队列。
 // 工作线程从请求队列中取出任务，完成读写数据的处理。
-template <typename T>
-class threadpool {
+template <typename T, typename Q = mpmc_queue<task> >
+class threadpool : public executor {
 public:
-    /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
+    static const int GROW_WAIT = 5;         // 任务排队超过该时间(毫秒)且没有空闲线程时增加线程
+    static const int IDLE_TIMEOUT = 60000;  // 超过最小线程数的线程空闲该时间(毫秒)后退出
+
+    /*thread_number是线程池中线程的最小数量，max_thread是最大数量(小于thread_number时不自动增加)，
+      max_requests是请求队列中最多允许的、等待处理的请求的数量，sched为调度方式，见SCHED_MODE*/
     threadpool( int actor_model, 
                 connection_pool* connPool,
                 int thread_number = 8,
-                int max_request = 10000);
+                int max_request = 10000,
+                int sched = SCHED_SHARED,
+                int max_thread = 0);
     ~threadpool();
     bool append(T *request, int state); //向请求队列中插入任务请求
     bool append_p(T *request);
+    // 一次放入事件循环本轮收集的n个任务，任务状态由调用者设置，返回从头开始放入的个数
+    int append_batch(T **requests, int n);
+    // 放入后台任务，与http请求由同一组工作线程执行
+    bool execute(task t, int priority = PRIO_NORMAL);
+    // 设置任务处理完成后的回调，由工作线程调用，用于把结果交还给事件循环
+    void set_done_callback(void (*done)(T *, void *), void *arg) {
+        m_done = done;
+        m_done_arg = arg;
+    }
+    // 设置处理数据库请求的线程池
+    void set_db_pool(threadpool *db_pool) {
+        m_db_pool = db_pool;
+    }
+    // 请求队列的统计: 队列数、各队列中等待的任务数和各工作线程窃取的任务数
+    int queues() const { return m_workqueue.queues(); }
+    size_t depth(int i) { return m_workqueue.depth(i); }
+    unsigned long steals(int i) const { return m_workqueue.steals(i); }
+    // 线程数的统计: 当前线程数、正在处理任务的线程数、平均排队时间(毫秒)、增加和退出的线程数
+    int live() const { return m_live; }
+    int busy() const { return m_busy; }
+    double wait_ms() const { return m_wait_avg / 1000.0; }
+    unsigned long grown() const { return m_grown; }
+    unsigned long shrunk() const { return m_shrunk; }
 
 private:
+    // 工作线程的槽位，线程退出后槽位由下一次增加线程或析构时回收
+    enum SLOT_STATE { SLOT_FREE = 0, SLOT_RUNNING, SLOT_EXITED };
+    struct slot {
+        threadpool *pool;
+        int id;
+        pthread_t tid;
+        std::atomic<int> state;
+    };
+
+    // http请求包装成的task，两个指针，存放在task内部
+    struct request_task {
+        threadpool *pool;
+        T *request;
+        void operator()() { pool->process(request); }
+    };
+    static const int BATCH = 32;    // append_batch每次包装的请求数
+
+    // 同一连接的请求使用相同的key，哈希和连接亲和模式下放入同一队列
+    static size_t key_of(T *request) {
+        return (uintptr_t)request / sizeof(T);
+    }
+    bool push_request(T *request);
+
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之。C++中必须是静态函数*/
     static void *worker(void *arg);
-    void run();
+    void run(int id);
+    bool start(int id);
+    void grow(long long stamp);
+    void process(T *request);
+    void handle(T *request);
+    // CLOCK_MONOTONIC_COARSE经vDSO读取，不进入内核，精度为一个时钟节拍
+    static long long coarse_us() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
 
 private:
-    int m_thread_number;            // 线程池中的线程数
-    pthread_t *m_threads;           // 描述线程池的数组，其大小为m_thread_number
+    int m_thread_number;            // 线程池中线程的最小数量
+    int m_thread_max;               // 线程池中线程的最大数量
+    slot *m_threads;                // 描述线程池的数组，其大小为m_thread_max
 
-    std::list<T *> m_workqueue;     // 请求队列
+    Q m_workqueue;                  // 请求队列
     int m_max_requests;             // 请求队列中允许的最大请求数
-    sem m_queuestat;                // 信号量: 是否有任务需要处理
-    locker m_queuelocker;           // 互斥锁: 保护请求队列的互斥锁
-    connection_pool *m_connPool;    // 数据库数据库连接池指针
+    connection_pool *m_connPool;    // 数据库数据库连接池指针，NULL表示本线程池不访问数据库
+    threadpool *m_db_pool;          // 需要数据库的请求转交的线程池
 
     int m_actor_model;              // 模型切换
+    void (*m_done)(T *, void *);    // 任务完成回调
+    void *m_done_arg;
+
+    std::atomic<int> m_live;                // 当前线程数
+    std::atomic<int> m_busy;                // 正在处理任务的线程数
+    std::atomic<long long> m_wait_avg;      // 排队时间的指数移动平均(微秒)
+    std::atomic<long long> m_saturated;     // 连续没有遇到空闲线程的入队中最早的入队时间，0为有空闲线程
+    std::atomic<long long> m_last_grow;     // 上一次增加线程的时间，每GROW_WAIT毫秒最多增加一个
+    std::atomic<unsigned long> m_grown;
+    std::atomic<unsigned long> m_shrunk;
+    std::atomic<size_t> m_next_key;         // 后台任务的key，轮流放入各队列
+    std::atomic<bool> m_stop;
+    locker m_grow_lock;                     // 增加线程时选择槽位
 };
 
-template <typename T>
-threadpool<T>::threadpool( int actor_model, 
+template <typename T, typename Q>
+threadpool<T, Q>::threadpool( int actor_model, 
                            connection_pool *connPool,
                            int thread_number,
-                           int max_requests) :
+                           int max_requests,
+                           int sched,
+                           int max_thread) :
                            m_actor_model(actor_model),
                            m_thread_number(thread_number), 
+                           m_thread_max(max_thread > thread_number ? max_thread : thread_number),
+                           m_workqueue(max_requests, thread_number > 0 ? thread_number : 1, sched),
                            m_max_requests(max_requests),
                            m_threads(NULL),
-                           m_connPool(connPool) {
+                           m_connPool(connPool),
+                           m_db_pool(NULL),
+                           m_done(NULL),
+                           m_done_arg(NULL),
+                           m_live(0),
+                           m_busy(0),
+                           m_wait_avg(0),
+                           m_saturated(0),
+                           m_last_grow(0),
+                           m_grown(0),
+                           m_shrunk(0),
+                           m_next_key(0),
+                           m_stop(false) {
     if (thread_number <= 0 || max_requests <= 0)
         throw std::exception();
 
-    m_threads = new pthread_t[m_thread_number];
-    if (!m_threads)
-        throw std::exception();
+    m_threads = new slot[m_thread_max];
+    for (int i = 0; i < m_thread_max; ++i) {
+        m_threads[i].pool = this;
+        m_threads[i].id = i;
+        m_threads[i].state = SLOT_FREE;
+    }
     for (int i = 0; i < thread_number; ++i) {
-        // 循环创建线程，并将工作线程按要求运行(worker参数)
-        // pthread_create的函数原型中第三个参数的类型为函数指针，
-        // 指向的线程处理函数参数类型为(void *),若线程函数为类成员函数，
-        // 则this指针会作为默认的参数被传进函数中，
-        // 从而和线程函数参数(void*)不能匹配，不能通过编译。
-        if (pthread_create(m_threads + i, NULL, worker, this) != 0) {
-            delete[] m_threads;
-            throw std::exception();
-        }
-        // 将线程进行分离后，不用单独对工作线程进行回收
-        if (pthread_detach(m_threads[i])) {
+        if (!start(i)) {
+            m_stop = true;
+            m_workqueue.close(m_thread_max);
+            for (int j = 0; j < i; ++j)
+                pthread_join(m_threads[j].tid, NULL);
             delete[] m_threads;
             throw std::exception();
         }
     }
 }
 
-template <typename T>
-threadpool<T>::~threadpool() {
+// 关闭请求队列，等待所有工作线程处理完手头的任务后退出并回收，队列中剩余的任务不再执行，随队列析构
+template <typename T, typename Q>
+threadpool<T, Q>::~threadpool() {
+    m_stop = true;
+    m_workqueue.close(m_thread_max);
+    //在锁内记下使用中的槽位，解锁后再join: 工作线程可能正在grow中等待这把锁。
+    //m_stop置位后grow不再创建线程，槽位不会再变化
+    bool *used = new bool[m_thread_max];
+    m_grow_lock.lock();
+    for (int i = 0; i < m_thread_max; ++i)
+        used[i] = SLOT_FREE != m_threads[i].state;
+    m_grow_lock.unlock();
+    for (int i = 0; i < m_thread_max; ++i) {
+        if (used[i])
+            pthread_join(m_threads[i].tid, NULL);
+    }
+    delete[] used;
     delete[] m_threads;     // 释放线程池
 }
 
-template <typename T>
-bool threadpool<T>::append(T* request, int state) {
-    m_queuelocker.lock();
-    if (m_workqueue.size() >= m_max_requests) {
-        m_queuelocker.unlock();
-        printf("workqueue reached maxsize!\n");
+// 在槽位id上创建工作线程
+template <typename T, typename Q>
+bool threadpool<T, Q>::start(int id) {
+    slot *s = &m_threads[id];
+    s->state = SLOT_RUNNING;
+    ++m_live;
+    // 循环创建线程，并将工作线程按要求运行(worker参数)
+    // pthread_create的函数原型中第三个参数的类型为函数指针，
+    // 指向的线程处理函数参数类型为(void *),若线程函数为类成员函数，
+    // 则this指针会作为默认的参数被传进函数中，
+    // 从而和线程函数参数(void*)不能匹配，不能通过编译。
+    // 线程不分离，退出后由grow或析构函数join回收
+    if (pthread_create(&s->tid, NULL, worker, s) != 0) {
+        s->state = SLOT_FREE;
+        --m_live;
         return false;
     }
+    return true;
+}
+
+// 入队后检查是否需要增加线程: 入队时没有空闲线程则记下时间，之后的入队都没有遇到空闲线程时，
+// 持续超过GROW_WAIT毫秒或测得的平均排队时间超过GROW_WAIT毫秒则增加一个线程
+template <typename T, typename Q>
+void threadpool<T, Q>::grow(long long stamp) {
+    //析构时不再增加线程，也不再等待析构函数持有的锁
+    if (m_stop)
+        return;
+    if (m_busy < m_live) {
+        if (m_saturated)
+            m_saturated = 0;
+        return;
+    }
+    if (m_live >= m_thread_max)
+        return;
+    long long since = 0;
+    m_saturated.compare_exchange_strong(since, stamp);
+    if (0 == since)
+        since = stamp;
+    if (stamp - since < GROW_WAIT * 1000 && m_wait_avg < GROW_WAIT * 1000)
+        return;
+    long long last = m_last_grow;
+    if (stamp - last < GROW_WAIT * 1000 || !m_last_grow.compare_exchange_strong(last, stamp))
+        return;
+
+    m_grow_lock.lock();
+    for (int i = 0; i < m_thread_max && !m_stop; ++i) {
+        slot *s = &m_threads[i];
+        if (SLOT_RUNNING == s->state)
+            continue;
+        // 回收已退出线程的槽位
+        if (SLOT_EXITED == s->state)
+            pthread_join(s->tid, NULL);
+        s->state = SLOT_FREE;
+        if (start(i))
+            ++m_grown;
+        break;
+    }
+    m_grow_lock.unlock();
+}
+
+template <typename T, typename Q>
+bool threadpool<T, Q>::append(T* request, int state) {
+    //状态在入队前写入，工作线程出队后可见
     request->m_state = state;
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();
+    if (!push_request(request)) {
+        printf("workqueue reached maxsize!\n");
+        return false;
+    }
     return true;
 }
 
-template <typename T>
-bool threadpool<T>::append_p(T* request) {
-    m_queuelocker.lock();
+template <typename T, typename Q>
+bool threadpool<T, Q>::append_p(T* request) {
     //根据硬件，预先设置请求队列的最大值
-    if (m_workqueue.size() >= m_max_requests) {
-        m_queuelocker.unlock();
+    return push_request(request);
+}
+
+template <typename T, typename Q>
+bool threadpool<T, Q>::push_request(T *request) {
+    request_task job = {this, request};
+    task t(job);
+    long long stamp = coarse_us();
+    if (!m_workqueue.push(t, key_of(request), PRIO_NORMAL, stamp))
         return false;
+    grow(stamp);
+    return true;
+}
+
+// 每次在栈上包装至多BATCH个请求后整批放入
+template <typename T, typename Q>
+int threadpool<T, Q>::append_batch(T** requests, int n) {
+    task jobs[BATCH];
+    size_t keys[BATCH];
+    long long stamp = coarse_us();
+    int pushed = 0;
+    while (pushed < n) {
+        int k = n - pushed < BATCH ? n - pushed : BATCH;
+        for (int i = 0; i < k; ++i) {
+            request_task job = {this, requests[pushed + i]};
+            jobs[i] = task(job);
+            keys[i] = key_of(requests[pushed + i]);
+        }
+        int got = m_workqueue.push_batch(jobs, keys, k, stamp);
+        pushed += got;
+        if (got < k)
+            break;
     }
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();
+    if (pushed > 0)
+        grow(stamp);
+    return pushed;
+}
+
+template <typename T, typename Q>
+bool threadpool<T, Q>::execute(task t, int priority) {
+    if (!t || m_stop)
+        return false;
+    long long stamp = coarse_us();
+    if (!m_workqueue.push(t, m_next_key++, priority, stamp))
+        return false;
+    grow(stamp);
     return true;
 }
 
 // 线程处理函数： 通过私有成员函数run，完成线程处理要求。
-template <typename T>
-void* threadpool<T>::worker(void* arg) {
-    threadpool* pool = (threadpool*)arg;
-    pool->run();
+template <typename T, typename Q>
+void* threadpool<T, Q>::worker(void* arg) {
+    slot *s = (slot *)arg;
+    threadpool* pool = s->pool;
+    pool->run(s->id);
     return pool;
 }
 // run执行任务： 主要实现工作线程从请求队列中取出某个任务进行处理，注意线程同步
-template <typename T>
-void threadpool<T>::run() {
-    while (true) {
-        //信号量等待
-        m_queuestat.wait();
-        //被唤醒后先加互斥锁
-        m_queuelocker.lock();
-        if (m_workqueue.empty()) {
-            m_queuelocker.unlock();
+template <typename T, typename Q>
+void threadpool<T, Q>::run(int id) {
+    while (!m_stop) {
+        //从请求队列中取出第一个任务，队列为空时阻塞; 工作窃取模式下先取本线程的队列
+        task job;
+        long long stamp = 0;
+        if (!m_workqueue.pop(id, job, stamp, m_thread_max > m_thread_number ? IDLE_TIMEOUT : 0)) {
+            //空闲超时: 超过最小线程数时本线程退出。只有增加的线程退出，
+            //前thread_number个线程一直运行，连接亲和模式下每个队列总有所属的工作线程
+            int live = m_live;
+            while (!m_stop && id >= m_thread_number && live > m_thread_number) {
+                if (m_live.compare_exchange_weak(live, live - 1)) {
+                    ++m_shrunk;
+                    m_threads[id].state = SLOT_EXITED;
+                    return;
+                }
+            }
             continue;
         }
-        //从请求队列中取出第一个任务, 并将任务从请求队列删除
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
-        if (!request)
-            continue;
 
-        // m_actor_model: 设置反应堆模型    
-        // 0：Proactor模型 
-        // 1：Reactor模型    
-        if (1 == m_actor_model)  {
-            if (0 == request->m_state) {
-                if (request->read_once()) {
-                    request->improv = 1;
-                    connectionRAII mysqlcon(&request->mysql, m_connPool);
-                    // process(模板类中的方法,这里是http类)进行处理
-                    request->process();
-                } else {
-                    request->improv = 1;
-                    request->timer_flag = 1;
-                }
+        //排队时间按1/8的权重计入平均值
+        ++m_busy;
+        long long now = coarse_us();
+        long long avg = m_wait_avg;
+        m_wait_avg = avg + (now - stamp - avg) / 8;
+        //积压期间没有新的任务入队时，由取出任务的工作线程继续增加线程
+        if (now - stamp >= GROW_WAIT * 1000)
+            grow(now);
+        job();
+        --m_busy;
+    }
+}
+
+// 处理一个任务，完成后交还事件循环
+template <typename T, typename Q>
+void threadpool<T, Q>::process(T *request) {
+    // m_actor_model: 设置反应堆模型    
+    // 0：Proactor模型 
+    // 1：Reactor模型    
+    // 2：io_uring Proactor模型，与0相同只需处理请求，收发由ring线程完成
+    if (1 == m_actor_model)  {
+        // 读写失败时置timer_flag，由完成回调交给事件循环关闭连接
+        if (0 == request->m_state) {
+            if (request->read_once()) {
+                // process(模板类中的方法,这里是http类)进行处理
+                handle(request);
             } else {
-                if (request->write()) {
-                    request->improv = 1;
-                } else {
-                    request->improv = 1;
-                    request->timer_flag = 1;
-                }
+                request->timer_flag = 1;
             }
         } else {
-            connectionRAII mysqlcon(&request->mysql, m_connPool);
-            request->process();
+            bool pipelined = false;
+            if (!request->write(pipelined)) {
+                request->timer_flag = 1;
+            } else if (pipelined) {
+                // 响应发完后读缓冲区中还有流水线请求，由本线程继续处理
+                handle(request);
+            }
         }
+    } else {
+        handle(request);
+    }
+    // 需要数据库的请求转交数据库线程池，由它完成后交还事件循环; 队列已满时关闭连接
+    if (m_db_pool && request->db_pending()) {
+        if (m_db_pool->append_p(request))
+            return;
+        request->timer_flag = 1;
+    }
+    if (m_done) {
+        m_done(request, m_done_arg);
+    }
+}
+
+// 数据库线程池在处理期间持有一个数据库连接，处理完归还并清空，静态文件线程池不取连接
+template <typename T, typename Q>
+void threadpool<T, Q>::handle(T *request) {
+    if (!m_connPool) {
+        request->process();
+        return;
     }
+    connectionRAII mysqlcon(&request->mysql, m_connPool);
+    request->process();
+    request->mysql = NULL;
 }
 
-#endif
\ No newline at end of file
+#endif
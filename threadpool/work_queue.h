@@ -0,0 +1,451 @@
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+/**
+ * 线程池的请求队列，作为threadpool的模板参数选择
+ * > * locked_queue: 互斥锁保护的链表 + 信号量，每次入队都要加锁并sem_post
+ * > * mpmc_queue: 有界无锁环形队列(Vyukov MPMC)，入队出队各一次CAS，
+ *     只有工作线程因队列为空而休眠时，入队才通过futex唤醒;
+ *     可选工作窃取模式，每个工作线程一个环，空闲时从其他环窃取;
+ *     或连接亲和模式，同一连接的任务总由同一个工作线程处理
+ * 两者接口相同: 队列按值存放任务(threadpool中为task)，入队时移入、出队时移出;
+ * push按优先级放入，key决定普通优先级任务所属的队列，队列满时返回false且不移动任务;
+ * push_batch一次放入多个普通优先级任务，返回从头开始放入的个数，只唤醒与放入的任务数相同的工作线程;
+ * pop阻塞直到取得任务，先取高优先级，低优先级任务只在没有其他任务可取时执行，参数为工作线程编号，
+ * 等待超过timeout_ms(大于0时)或队列已关闭时返回false。每个任务带有入队时间，供线程池统计排队时间
+ **/
+#include <list>
+#include <utility>
+#include <atomic>
+#include <exception>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "../lock/locker.h"
+#include "executor.h"
+
+template <typename T>
+class locked_queue {
+public:
+    locked_queue(int max_requests, int workers = 1, int sched = 0) : m_max_requests(max_requests), m_closed(false) {}
+
+    bool push(T &item, size_t key, int prio, long long stamp) {
+        m_queuelocker.lock();
+        if (m_workqueue[prio].size() >= m_max_requests) {
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue[prio].push_back(std::make_pair(std::move(item), stamp));
+        m_queuelocker.unlock();
+        m_queuestat.post();
+        return true;
+    }
+
+    // 一次加锁放入
+    int push_batch(T *items, const size_t *keys, int n, long long stamp) {
+        m_queuelocker.lock();
+        int pushed = 0;
+        while (pushed < n && m_workqueue[PRIO_NORMAL].size() < m_max_requests)
+            m_workqueue[PRIO_NORMAL].push_back(std::make_pair(std::move(items[pushed++]), stamp));
+        m_queuelocker.unlock();
+        for (int i = 0; i < pushed; ++i)
+            m_queuestat.post();
+        return pushed;
+    }
+
+    bool pop(int worker, T &item, long long &stamp, int timeout_ms) {
+        while (true) {
+            //信号量等待，被唤醒后先加互斥锁
+            if (timeout_ms > 0 ? !m_queuestat.wait(timeout_ms) : !m_queuestat.wait()) {
+                if (EINTR == errno)
+                    continue;
+                return false;
+            }
+            m_queuelocker.lock();
+            if (m_closed) {
+                m_queuelocker.unlock();
+                return false;
+            }
+            //从优先级最高的非空队列中取出第一个任务, 并将任务从请求队列删除
+            int prio = 0;
+            while (prio < PRIO_NUM && m_workqueue[prio].empty())
+                ++prio;
+            if (PRIO_NUM == prio) {
+                m_queuelocker.unlock();
+                continue;
+            }
+            item = std::move(m_workqueue[prio].front().first);
+            stamp = m_workqueue[prio].front().second;
+            m_workqueue[prio].pop_front();
+            m_queuelocker.unlock();
+            return true;
+        }
+    }
+
+    // 关闭队列，唤醒所有等待的工作线程
+    void close(int workers) {
+        m_queuelocker.lock();
+        m_closed = true;
+        m_queuelocker.unlock();
+        for (int i = 0; i < workers; ++i)
+            m_queuestat.post();
+    }
+
+    int queues() const { return 1; }
+    size_t depth(int i) {
+        m_queuelocker.lock();
+        size_t n = m_workqueue[PRIO_NORMAL].size();
+        m_queuelocker.unlock();
+        return n;
+    }
+    unsigned long steals(int i) const { return 0; }
+
+private:
+    std::list<std::pair<T, long long> > m_workqueue[PRIO_NUM];  // 各优先级的请求队列，任务与入队时间
+    int m_max_requests;             // 每个优先级的请求队列中允许的最大请求数
+    sem m_queuestat;                // 信号量: 是否有任务需要处理
+    locker m_queuelocker;           // 互斥锁: 保护请求队列的互斥锁
+    bool m_closed;
+};
+
+// 每个槽位带一个序号: 序号等于入队位置时可写入，等于入队位置+1时可读出，
+// 读出后序号加上容量，留给下一圈的入队者。生产者和消费者只在各自的位置计数器上CAS
+template <typename T>
+class mpmc_ring {
+public:
+    mpmc_ring() : m_steals(0), m_cells(NULL), m_mask(0), m_enqueue_pos(0), m_dequeue_pos(0) {}
+    // 未取出的任务随槽位析构
+    ~mpmc_ring() {
+        delete[] m_cells;
+    }
+    // 容量向上取整为2的幂，下标用掩码计算
+    void init(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_mask = size - 1;
+        m_cells = new cell[size];
+        for (size_t i = 0; i < size; ++i)
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // 失败时不移动item
+    bool try_push(T &item, long long stamp) {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        while (true) {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+            if (0 == diff) {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // 槽位还没有被上一圈的消费者取走，队列已满
+                return false;
+            } else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = std::move(item);
+        c->stamp = stamp;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 一次CAS连续占用至多n个槽位，返回占用并写入的个数，队列满时为0
+    int try_push_n(T *items, int n, long long stamp) {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        int k;
+        while (true) {
+            k = 0;
+            while (k < n) {
+                size_t seq = m_cells[(pos + k) & m_mask].seq.load(std::memory_order_acquire);
+                if (seq != pos + k)
+                    break;
+                ++k;
+            }
+            if (0 == k) {
+                ptrdiff_t diff = (ptrdiff_t)m_cells[pos & m_mask].seq.load(std::memory_order_acquire) - (ptrdiff_t)pos;
+                if (diff < 0)
+                    return 0;
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (m_enqueue_pos.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed))
+                break;
+        }
+        for (int i = 0; i < k; ++i) {
+            cell *c = &m_cells[(pos + i) & m_mask];
+            c->data = std::move(items[i]);
+            c->stamp = stamp;
+            c->seq.store(pos + i + 1, std::memory_order_release);
+        }
+        return k;
+    }
+
+    bool try_pop(T &item, long long &stamp) {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        while (true) {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+            if (0 == diff) {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // 槽位还没有被写入，队列为空
+                return false;
+            } else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(c->data);
+        stamp = c->stamp;
+        c->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列中的任务数，并发修改时为近似值
+    size_t depth() const {
+        size_t in = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t out = m_dequeue_pos.load(std::memory_order_relaxed);
+        return in > out ? in - out : 0;
+    }
+
+    std::atomic<unsigned long> m_steals;    // 该队列的工作线程从其他队列取得的任务数
+
+private:
+    struct cell {
+        std::atomic<size_t> seq;
+        T data;
+        long long stamp;
+    };
+
+    // 入队和出队位置分别放在独立的缓存行，生产者和消费者互不干扰
+    static const int CACHELINE = 64;
+    cell *m_cells;
+    size_t m_mask;
+    char m_pad0[CACHELINE];
+    std::atomic<size_t> m_enqueue_pos;
+    char m_pad1[CACHELINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_dequeue_pos;
+    char m_pad2[CACHELINE - sizeof(std::atomic<size_t>)];
+};
+
+// 调度方式
+enum SCHED_MODE
+{
+    SCHED_SHARED = 0,   // 所有工作线程共用一个队列
+    SCHED_ROUND_ROBIN,  // 每个工作线程一个队列，任务轮流放入各队列，空闲的工作线程从其他队列窃取
+    SCHED_HASH,         // 每个工作线程一个队列，同一连接的任务放入同一队列，空闲的工作线程从其他队列窃取
+    SCHED_AFFINITY      // 每个工作线程一个队列，同一连接的任务放入同一队列并只唤醒该队列的工作线程，
+                        // 该队列积压时才放入其他队列，其他工作线程也只窃取积压的队列
+};
+
+// 由mpmc_ring组成的请求队列: 共享模式只有一个环，工作窃取模式每个工作线程一个环。
+// 工作线程先取自己的环，为空时依次窃取其他环; 所有环都为空时在同一个futex上休眠，
+// 入队后唤醒的线程不一定是该环的所有者，由它窃取。
+// 连接亲和模式下每个环有自己的futex，连接对象和它的缓冲区留在同一个工作线程所在CPU的缓存中。
+// 高、低优先级的任务各放入一个所有工作线程共用的环，不参与调度
+template <typename T>
+class mpmc_queue {
+public:
+    static const size_t AFFINITY_DEPTH = 2;     // 连接亲和模式下环中排队的任务达到该数量时视为积压
+
+    mpmc_queue(int max_requests, int workers = 1, int sched = SCHED_SHARED)
+        : m_next(0), m_closed(false) {
+        if (max_requests <= 0 || workers <= 0)
+            throw std::exception();
+        m_sched = sched;
+        m_nrings = (SCHED_SHARED == sched) ? 1 : workers;
+        m_rings = new mpmc_ring<T>[m_nrings];
+        for (int i = 0; i < m_nrings; ++i)
+            m_rings[i].init((max_requests + m_nrings - 1) / m_nrings);
+        m_high.init(max_requests);
+        m_low.init(max_requests);
+        m_nwaiters = (SCHED_AFFINITY == sched) ? m_nrings : 1;
+        m_waiters = new waiter[m_nwaiters];
+    }
+    ~mpmc_queue() {
+        delete[] m_rings;
+        delete[] m_waiters;
+    }
+
+    bool push(T &item, size_t key, int prio, long long stamp) {
+        if (PRIO_NORMAL != prio) {
+            if (!(PRIO_HIGH == prio ? m_high : m_low).try_push(item, stamp))
+                return false;
+            wake_any();
+            return true;
+        }
+        int ring = enqueue(item, key, stamp);
+        if (ring < 0)
+            return false;
+        wake(waiter_of(ring), 1);
+        return true;
+    }
+
+    // 共享模式下一次CAS占用整批槽位; 工作窃取模式下逐个按调度方式放入。最后统一唤醒一次
+    int push_batch(T *items, const size_t *keys, int n, long long stamp) {
+        int pushed = 0;
+        if (1 == m_nrings) {
+            int k;
+            while (pushed < n && (k = m_rings[0].try_push_n(items + pushed, n - pushed, stamp)) > 0)
+                pushed += k;
+        } else if (SCHED_AFFINITY == m_sched) {
+            // 各任务放入不同的环，分别唤醒对应的工作线程
+            int ring;
+            while (pushed < n && (ring = enqueue(items[pushed], keys[pushed], stamp)) >= 0) {
+                wake(waiter_of(ring), 1);
+                ++pushed;
+            }
+            return pushed;
+        } else {
+            while (pushed < n && enqueue(items[pushed], keys[pushed], stamp) >= 0)
+                ++pushed;
+        }
+        if (pushed > 0)
+            wake(&m_waiters[0], pushed);
+        return pushed;
+    }
+
+    // worker为工作线程的编号
+    bool pop(int worker, T &item, long long &stamp, int timeout_ms) {
+        int home = worker % m_nrings;
+        waiter *w = waiter_of(home);
+        struct timespec ts = {timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000};
+        while (true) {
+            if (m_closed.load(std::memory_order_acquire))
+                return false;
+            if (take(home, item, stamp))
+                return true;
+            // 先记下epoch再登记休眠，登记后入队的任务会改变epoch，futex_wait立即返回
+            int epoch = w->epoch.load(std::memory_order_acquire);
+            w->sleepers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (take(home, item, stamp)) {
+                w->sleepers.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            long ret = futex(w, FUTEX_WAIT_PRIVATE, epoch, timeout_ms > 0 ? &ts : NULL);
+            w->sleepers.fetch_sub(1, std::memory_order_relaxed);
+            // 超时前最后检查一次，不丢下超时期间入队的任务
+            if (ret < 0 && ETIMEDOUT == errno)
+                return take(home, item, stamp);
+        }
+    }
+
+    // 关闭队列，唤醒所有等待的工作线程，每个futex上最多有workers个
+    void close(int workers) {
+        m_closed.store(true, std::memory_order_release);
+        for (int i = 0; i < m_nwaiters; ++i) {
+            m_waiters[i].epoch.fetch_add(1, std::memory_order_release);
+            futex(&m_waiters[i], FUTEX_WAKE_PRIVATE, workers, NULL);
+        }
+    }
+
+    // 统计: 队列数、各队列深度和各工作线程的窃取次数
+    int queues() const { return m_nrings; }
+    size_t depth(int i) const { return m_rings[i].depth(); }
+    unsigned long steals(int i) const { return m_rings[i].m_steals.load(std::memory_order_relaxed); }
+
+private:
+    // futex字与休眠的工作线程数，各自独占缓存行
+    struct waiter {
+        waiter() : epoch(0), sleepers(0) {}
+        std::atomic<int> epoch;             // futex字: 每次唤醒前加一
+        std::atomic<int> sleepers;          // 因队列为空而休眠的工作线程数
+        char pad[64 - 2 * sizeof(std::atomic<int>)];
+    };
+
+    waiter *waiter_of(int ring) {
+        return &m_waiters[SCHED_AFFINITY == m_sched ? ring : 0];
+    }
+
+    // 按调度方式选择环，满时依次放入其他环，返回放入的环，都已满时返回-1。
+    // 连接亲和模式下连接所属的环积压时，放入第一个没有积压的环
+    int enqueue(T &item, size_t key, long long stamp) {
+        int start = 0;
+        if (SCHED_ROUND_ROBIN == m_sched)
+            start = m_next.fetch_add(1, std::memory_order_relaxed) % m_nrings;
+        else if (SCHED_HASH == m_sched || SCHED_AFFINITY == m_sched)
+            start = (int)(key % m_nrings);
+        if (SCHED_AFFINITY == m_sched) {
+            for (int i = 0; i < m_nrings; ++i) {
+                int ring = (start + i) % m_nrings;
+                if (m_rings[ring].depth() < AFFINITY_DEPTH && m_rings[ring].try_push(item, stamp))
+                    return ring;
+            }
+        }
+        for (int i = 0; i < m_nrings; ++i) {
+            int ring = (start + i) % m_nrings;
+            if (m_rings[ring].try_push(item, stamp))
+                return ring;
+        }
+        return -1;
+    }
+
+    // 与pop中登记休眠的顺序配对: 要么这里看到休眠者并唤醒，要么休眠者在登记后重新检查时取到任务。
+    // 只唤醒n个休眠者，没有休眠者时不进入内核
+    void wake(waiter *w, int n) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int sleepers = w->sleepers.load(std::memory_order_relaxed);
+        if (sleepers > 0) {
+            w->epoch.fetch_add(1, std::memory_order_release);
+            futex(w, FUTEX_WAKE_PRIVATE, n < sleepers ? n : sleepers, NULL);
+        }
+    }
+
+    // 高、低优先级的任务不属于任何环，唤醒任意一个休眠的工作线程
+    void wake_any() {
+        int start = m_next.fetch_add(1, std::memory_order_relaxed) % m_nwaiters;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (int i = 0; i < m_nwaiters; ++i) {
+            waiter *w = &m_waiters[(start + i) % m_nwaiters];
+            if (w->sleepers.load(std::memory_order_relaxed) > 0) {
+                wake(w, 1);
+                return;
+            }
+        }
+    }
+
+    // 连接亲和模式下只窃取积压的环，其余的留给所属的工作线程; 没有普通任务可取时才取低优先级任务
+    bool take(int home, T &item, long long &stamp) {
+        if (m_high.try_pop(item, stamp))
+            return true;
+        if (m_rings[home].try_pop(item, stamp))
+            return true;
+        for (int i = 1; i < m_nrings; ++i) {
+            mpmc_ring<T> &ring = m_rings[(home + i) % m_nrings];
+            if (SCHED_AFFINITY == m_sched && ring.depth() < AFFINITY_DEPTH)
+                continue;
+            if (ring.try_pop(item, stamp)) {
+                m_rings[home].m_steals.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return m_low.try_pop(item, stamp);
+    }
+
+    long futex(waiter *w, int op, int val, const struct timespec *timeout) {
+        return syscall(SYS_futex, (int *)&w->epoch, op, val, timeout, NULL, 0);
+    }
+
+    mpmc_ring<T> *m_rings;
+    int m_nrings;
+    mpmc_ring<T> m_high;                    // 高优先级任务
+    mpmc_ring<T> m_low;                     // 低优先级任务
+    int m_sched;
+    std::atomic<unsigned> m_next;           // 轮流放入时下一个环
+    waiter *m_waiters;                      // 连接亲和模式每个环一个，其余模式共用一个
+    int m_nwaiters;
+    std::atomic<bool> m_closed;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include "cached_clock.h"
+
+static const char *week[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                               "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+cached_clock::cached_clock() : m_current(0), m_msec(0), m_wall_msec(0), m_updating(false) {
+    m_slots[0].sec = -1;
+    update();
+}
+
+cached_clock *cached_clock::get_instance() {
+    static cached_clock clock;
+    return &clock;
+}
+
+void cached_clock::update() {
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+
+    // 多个reactor可能交错更新，只向前推进，定时器看到的时间不会倒退
+    long long msec = (long long)mono.tv_sec * 1000 + mono.tv_nsec / 1000000;
+    long long cur = m_msec.load(std::memory_order_relaxed);
+    while (msec > cur && !m_msec.compare_exchange_weak(cur, msec, std::memory_order_relaxed))
+        ;
+    m_wall_msec.store(real.tv_nsec / 1000000, std::memory_order_relaxed);
+
+    if (real.tv_sec == now()->sec)
+        return;
+    // 其他reactor正在格式化这一秒，直接使用它的结果
+    if (m_updating.exchange(true, std::memory_order_acquire))
+        return;
+
+    int next = (m_current.load(std::memory_order_relaxed) + 1) % SLOTS;
+    slot *s = &m_slots[next];
+    s->sec = real.tv_sec;
+
+    // Date头固定使用GMT和英文缩写，不受locale影响
+    struct tm gmt;
+    gmtime_r(&real.tv_sec, &gmt);
+    snprintf(s->http_date, sizeof(s->http_date), "%s, %02d %s %d %02d:%02d:%02d GMT",
+             week[gmt.tm_wday], gmt.tm_mday, months[gmt.tm_mon], gmt.tm_year + 1900,
+             gmt.tm_hour, gmt.tm_min, gmt.tm_sec);
+
+    localtime_r(&real.tv_sec, &s->local);
+    snprintf(s->log_time, sizeof(s->log_time), "%d-%02d-%02d %02d:%02d:%02d",
+             s->local.tm_year + 1900, s->local.tm_mon + 1, s->local.tm_mday,
+             s->local.tm_hour, s->local.tm_min, s->local.tm_sec);
+
+    m_current.store(next, std::memory_order_release);
+    m_updating.store(false, std::memory_order_release);
+}
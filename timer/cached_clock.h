@@ -0,0 +1,50 @@
+#ifndef CACHED_CLOCK_H
+#define CACHED_CLOCK_H
+/*
+缓存时钟
+===============
+事件循环每轮读取一次时钟，定时器、日志和响应头都使用缓存的时间，不再各自调用时间相关的系统调用和格式化
+> * 单例模式，各reactor、工作线程和日志共用
+> * 单调时钟毫秒数供定时器使用，每轮更新
+> * 墙上时间每秒变化时格式化一次Date响应头和日志时间前缀，放入新的槽位后再发布，
+    读者拿到的槽位在之后的SLOTS秒内不会被改写，读取无需加锁
+> * 多个reactor同时更新时只有一个进行格式化，其余直接返回
+*/
+#include <time.h>
+#include <atomic>
+
+class cached_clock {
+public:
+    // 同一秒内的格式化结果
+    struct slot {
+        time_t sec;                 // 墙上时间秒数
+        struct tm local;            // 本地时间，日志按天分文件使用
+        char http_date[32];         // RFC 7231 Date格式，如Sun, 06 Nov 1994 08:49:37 GMT
+        char log_time[64];          // 日志时间前缀，如1994-11-06 16:49:37，按各字段的最大宽度留足
+    };
+
+    // 使用局部静态变量懒汉模式创建时钟
+    static cached_clock *get_instance();
+
+    // 读取时钟并更新缓存，由事件循环每轮调用一次
+    void update();
+
+    long long now_ms() const { return m_msec.load(std::memory_order_relaxed); }      // 单调时钟毫秒数
+    int wall_ms() const { return m_wall_msec.load(std::memory_order_relaxed); }      // 墙上时间的毫秒部分
+    const slot *now() const { return &m_slots[m_current.load(std::memory_order_acquire)]; }
+    time_t now_sec() const { return now()->sec; }
+    const char *http_date() const { return now()->http_date; }
+
+private:
+    static const int SLOTS = 64;
+
+    cached_clock();
+
+    slot m_slots[SLOTS];
+    std::atomic<int> m_current;             // 已发布的槽位
+    std::atomic<long long> m_msec;
+    std::atomic<int> m_wall_msec;
+    std::atomic<bool> m_updating;           // 正在格式化新的槽位
+};
+
+#endif
@@ -1,155 +1,204 @@
 #include "lst_timer.h"
 #include "../http/http_conn.h"
+#include "../http/conn_slab.h"
 
-sort_timer_lst::sort_timer_lst() {
-    head = NULL;
-    tail = NULL;
+time_wheel::time_wheel() : m_count(0) {
+    init(Utils::now_ms());
 }
 
-// 常规销毁链表
-sort_timer_lst::~sort_timer_lst() {
-    util_timer *tmp = head;
-    while (tmp) {
-        head = tmp->next;
-        delete tmp;
-        tmp = head;
-    }
+time_wheel::time_wheel(long long now) : m_count(0) {
+    init(now);
+}
+
+void time_wheel::init(long long now) {
+    memset(m_expired, 0, sizeof(m_expired));
+    // 各槽位的哨兵结点自成一个空的循环链表
+    for (int i = 0; i < ROOT_SIZE; ++i)
+        m_root[i].prev = m_root[i].next = &m_root[i];
+    for (int l = 0; l < LEVELS; ++l)
+        for (int i = 0; i < LEVEL_SIZE; ++i)
+            m_levels[l][i].prev = m_levels[l][i].next = &m_levels[l][i];
+    m_now = now;
 }
 
-// 添加定时器，内部调用私有成员add_timer
-void sort_timer_lst::add_timer(util_timer *timer) {
+// 添加定时器
+void time_wheel::add_timer(util_timer *timer) {
     if (!timer) {
         return;
     }
-    if (!head) {
-        head = tail = timer;
-        return;
-    }
-    //如果新的定时器超时时间小于当前头部结点
-    //直接将当前定时器结点作为头部结点
-    if (timer->expire < head->expire) {
-        timer->next = head;
-        head->prev = timer;
-        head = timer;
+    insert(timer);
+    ++m_count;
+}
+// 调整定时器，超时时间变化后从原槽位摘下，放入新的槽位
+void time_wheel::adjust_timer(util_timer *timer) {
+    if (!timer || !timer->prev) {
         return;
     }
-    //否则调用私有成员，调整内部结点
-    add_timer(timer, head);
+    unlink(timer);
+    insert(timer);
 }
-// 调整定时器，任务发生变化时，调整定时器在链表中的位置
-void sort_timer_lst::adjust_timer(util_timer *timer) {
-    if (!timer) {
+// 删除定时器
+void time_wheel::del_timer(util_timer *timer) {
+    if (!timer || !timer->prev) {
         return;
     }
-    util_timer *tmp = timer->next;
-    //被调整的定时器在链表尾部
-    //定时器超时值仍然小于下一个定时器超时值，不调整
-    if (!tmp || (timer->expire < tmp->expire)) {
+    unlink(timer);
+    --m_count;
+}
+// 定时任务处理函数: 使用统一事件源，timerfd每次到期，事件循环中调用一次定时任务处理函数。
+// 具体的逻辑如下:
+// * 从上次处理到的时刻起逐毫秒推进到当前时间，第一层每转完一圈，把上层对应槽位中的定时器级联到下层;
+// * 每推进一毫秒，第一层对应槽位中的定时器都已到期，逐个摘下并执行回调函数;
+// * 回调函数可能关闭连接，每次都从槽位链表头部取，不保存后继结点.
+void time_wheel::tick() {
+    // 获取当前时间
+    tick(Utils::now_ms());
+}
+
+void time_wheel::tick(long long cur) {
+    // 时间轮为空时直接跳到当前时间
+    if (0 == m_count) {
+        m_now = cur + 1;
         return;
     }
-    //被调整定时器是链表头结点，将定时器取出，重新插入
-    if (timer == head) {
-        head = head->next;
-        head->prev = NULL;
-        timer->next = NULL;
-        add_timer(timer, head);
-    } else {
-        //被调整定时器在内部，将定时器取出，重新插入
-        timer->prev->next = timer->next;
-        timer->next->prev = timer->prev;
-        add_timer(timer, timer->next);
+    while (m_now <= cur) {
+        int index = m_now & ROOT_MASK;
+        // 第一层转完一圈，逐层级联，上层的槽位同样转完一圈时再级联更上一层
+        if (0 == index) {
+            for (int l = 0; l < LEVELS; ++l) {
+                int shift = ROOT_BITS + l * LEVEL_BITS;
+                int i = (m_now >> shift) & LEVEL_MASK;
+                cascade(&m_levels[l][i]);
+                if (i != 0)
+                    break;
+            }
+        }
+        util_timer *slot = &m_root[index];
+        while (slot->next != slot) {
+            util_timer *tmp = slot->next;
+            unlink(tmp);
+            --m_count;
+            ++m_expired[tmp->phase];
+            // 当前定时器到期，则调用回调函数，执行定时事件
+            tmp->cb_func(tmp->user_data);
+        }
+        ++m_now;
     }
 }
-// 删除定时器
-void sort_timer_lst::del_timer(util_timer *timer) {
-    if (!timer) {
-        return;
-    }
-    // 链表中只有一个定时器，需要删除该定时器
-    if ((timer == head) && (timer == tail)) {
-        delete timer;
-        head = NULL;
-        tail = NULL;
-        return;
+
+long long time_wheel::next_expire() const {
+    if (0 == m_count) {
+        return -1;
     }
-    // 被删除的定时器为头结点
-    if (timer == head) {
-        head = head->next;
-        head->prev = NULL;
-        delete timer;
-        return;
+    // 第一层的槽位最多一圈，期间经过第一层边界时可能先发生级联;
+    // tick停下的m_now本身可能就是尚未级联的边界
+    long long t = m_now;
+    for (int i = 0; i < ROOT_SIZE; ++i, ++t) {
+        if (0 == (t & ROOT_MASK) && cascades_at(t))
+            return t;
+        if (m_root[t & ROOT_MASK].next != &m_root[t & ROOT_MASK])
+            return t;
     }
-    // 被删除的定时器为尾结点
-    if (timer == tail) {
-        tail = tail->prev;
-        tail->next = NULL;
-        delete timer;
-        return;
+    // 第一层为空，找到第一个会级联出定时器的边界(m_now为边界时从它开始)，最多经过第二层的一圈
+    t = ((m_now + ROOT_MASK) >> ROOT_BITS) << ROOT_BITS;
+    while (!cascades_at(t))
+        t += ROOT_SIZE;
+    return t;
+}
+
+void time_wheel::insert(util_timer *timer) {
+    long long expire = timer->expire;
+    long long delta = expire - m_now;
+    util_timer *slot;
+    if (delta < 0) {
+        // 已经到期，放入下一个要处理的槽位
+        slot = &m_root[m_now & ROOT_MASK];
+    } else if (delta < ROOT_SIZE) {
+        slot = &m_root[expire & ROOT_MASK];
+    } else {
+        // 超过时间轮范围的按最远处理，级联时会再次放入合适的层
+        if (delta >= MAX_SPAN)
+            expire = m_now + MAX_SPAN - 1;
+        int l = 0;
+        while (delta >= (1LL << (ROOT_BITS + (l + 1) * LEVEL_BITS)) && l < LEVELS - 1)
+            ++l;
+        slot = &m_levels[l][(expire >> (ROOT_BITS + l * LEVEL_BITS)) & LEVEL_MASK];
     }
-    // 被删除的定时器在链表内部，常规链表结点删除
+    // 插入槽位链表尾部
+    timer->prev = slot->prev;
+    timer->next = slot;
+    slot->prev->next = timer;
+    slot->prev = timer;
+}
+
+void time_wheel::unlink(util_timer *timer) {
     timer->prev->next = timer->next;
     timer->next->prev = timer->prev;
-    delete timer;
+    timer->prev = NULL;
+    timer->next = NULL;
 }
-// 定时任务处理函数: 使用统一事件源，SIGALRM信号每次被触发，主循环中调用一次定时任务处理函数，处理链表容器中到期的定时器。
-// 具体的逻辑如下:
-// * 遍历定时器升序链表容器，从头结点开始依次处理每个定时器，直到遇到尚未到期的定时器;
-// * 若当前时间小于定时器超时时间，跳出循环，即未找到到期的定时器;
-// * 若当前时间大于定时器超时时间，即找到了到期的定时器，执行回调函数，然后将它从链表中删除，然后继续遍历.
 
-void sort_timer_lst::tick() {
-    if (!head) {
+void time_wheel::cascade(util_timer *slot) {
+    if (slot->next == slot) {
         return;
     }
-    // 获取当前时间
-    time_t cur = time(NULL);
-    util_timer *tmp = head;
-    // 遍历定时器链表
+    // 先整体摘下，重新放入时不会回到同一个槽位里被重复处理
+    util_timer *tmp = slot->next;
+    slot->prev->next = NULL;
+    slot->prev = slot->next = slot;
     while (tmp) {
-        // 链表容器为升序排列
-        // 当前时间小于定时器的超时时间，后面的定时器也没有到期
-        if (cur < tmp->expire) {
-            break;
-        }
-        // 当前定时器到期，则调用回调函数，执行定时事件
-        tmp->cb_func(tmp->user_data);
-        
-        // 将处理后的定时器从链表容器中删除，并重置头结点
-        head = tmp->next;
-        if (head) {
-            head->prev = NULL;
-        }
-        delete tmp;
-        tmp = head;
+        util_timer *next = tmp->next;
+        insert(tmp);
+        tmp = next;
     }
 }
 
-void sort_timer_lst::add_timer(util_timer *timer, util_timer *lst_head) {
-    util_timer *prev = lst_head;
-    util_timer *tmp = prev->next;
-    // 遍历当前结点之后的链表，按照超时时间找到目标定时器对应的位置，常规双向链表插入操作
-    while (tmp) {
-        if (timer->expire < tmp->expire) {
-            prev->next = timer;
-            timer->next = tmp;
-            tmp->prev = timer;
-            timer->prev = prev;
-            break;
-        }
-        prev = tmp;
-        tmp = tmp->next;
+bool time_wheel::cascades_at(long long t) const {
+    for (int l = 0; l < LEVELS; ++l) {
+        int i = (t >> (ROOT_BITS + l * LEVEL_BITS)) & LEVEL_MASK;
+        const util_timer *slot = &m_levels[l][i];
+        if (slot->next != slot)
+            return true;
+        if (i != 0)
+            return false;
+    }
+    return false;
+}
+
+void Utils::init(int timerfd, int interval) {
+    m_timerfd = timerfd;
+    m_interval = interval;
+    m_armed = 0;
+}
+
+long long Utils::deadline(util_timer *timer, int phase, unsigned seq, long long body_bytes) {
+    long long now = now_ms();
+    // 发送响应和长连接空闲每次都重新计时; 请求头和消息体只在阶段开始时计时，
+    // 每次只到达一两个字节的慢速请求不能无限期地占用连接
+    if (phase != timer->phase || seq != timer->seq || PHASE_WRITE == phase || PHASE_KEEPALIVE == phase) {
+        timer->phase = phase;
+        timer->seq = seq;
+        timer->start = now;
     }
-    // 遍历完发现，目标定时器需要放到尾结点处
-    if (!tmp) {
-        prev->next = timer;
-        timer->prev = prev;
-        timer->next = NULL;
-        tail = timer;
+    switch (phase) {
+        case PHASE_HEADER:
+            return timer->start + m_deadlines.header;
+        case PHASE_BODY:
+        {
+            long long expire = timer->start + m_deadlines.body;
+            if (m_deadlines.body_rate > 0)
+                expire += body_bytes * 1000 / m_deadlines.body_rate;
+            return expire;
+        }
+        case PHASE_WRITE:
+            return now + m_deadlines.write;
+        default:
+            return now + m_deadlines.keepalive;
     }
 }
 
-void Utils::init(int timeslot) {
-    m_TIMESLOT = timeslot;
+long long Utils::now_ms() {
+    return cached_clock::get_instance()->now_ms();
 }
 
 //对文件描述符设置非阻塞
@@ -161,9 +210,10 @@ int Utils::setnonblocking(int fd) {
 }
 
 //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
+//事件中直接存放fd，高位为0，与连接句柄区分
 void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode) {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = fd;
     if (1 == TRIGMode)
         event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
     else
@@ -175,21 +225,6 @@ void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode) {
     setnonblocking(fd);
 }
 
-//信号处理函数
-void Utils::sig_handler(int sig) {
-    //为保证函数的可重入性，保留原来的errno
-    //可重入性表示中断后再次进入该函数，环境变量与之前相同，不会丢失数据
-    int save_errno = errno;
-    int msg = sig;
-    // ssize_t send(int sockfd, const void *buf, size_t len, int flags);
-    // 当套接字发送缓冲区变满时，send通常会阻塞，除非套接字设置为非阻塞模式，
-    // 当缓冲区变满时，返回EAGAIN或者EWOULDBLOCK错误，此时可以调用select函数来监视何时可以发送数据。
-    // 将信号值从管道写端写入，传输字符类型，而非整型
-    send(u_pipefd[1], (char *)&msg, 1, 0);
-    // 将原来的errno赋值为当前的errno
-    errno = save_errno;
-}
-
 //设置信号函数
 void Utils::addsig(int sig, void(handler)(int), bool restart) {
 /*
@@ -221,13 +256,32 @@ struct sigaction {
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-//定时处理任务，重新定时以不断触发SIGALRM信号
+//按时间轮中下一个需要处理的时刻设置timerfd
+//新定时器一般晚于已有的定时器，延长定时器只会推迟该时刻，所以只有timerfd未设置或该时刻提前时才需要重新设置，
+//该时刻推迟后timerfd会提前到期一次，tick没有到期的定时器，随后按时间轮重新设置;
+//时间轮为空或该时刻很远时最多interval后到期，供事件循环执行统计输出、回收空闲连接对象等周期性任务
+void Utils::arm_timer() {
+    long long expire = m_timer_wheel.next_expire();
+    if (m_armed > 0 && (expire < 0 || m_armed <= expire))
+        return;
+    long long limit = now_ms() + m_interval;
+    if (expire < 0 || expire > limit)
+        expire = limit;
+    // int timerfd_settime(int fd, int flags, const struct itimerspec *new_value, struct itimerspec *old_value);
+    // TFD_TIMER_ABSTIME表示it_value为绝对时间，it_interval为0表示只到期一次
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = expire / 1000;
+    its.it_value.tv_nsec = (expire % 1000) * 1000000;
+    timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    m_armed = expire;
+}
+
+//定时处理任务，timerfd的到期计数已由调用者读出
 void Utils::timer_handler() {
-    m_timer_lst.tick();
-    // unsigned int alarm(unsigned int seconds);
-    // 设置信号传送闹钟，即用来设置信号SIGALRM在经过参数seconds秒数后发送给目前的进程。
-    // 如果未设置信号SIGALRM的处理函数，那么alarm()默认处理终止进程.
-    alarm(m_TIMESLOT);
+    m_armed = 0;
+    m_timer_wheel.tick();
+    arm_timer();
 }
 
 void Utils::show_error(int connfd, const char *info) {
@@ -235,17 +289,28 @@ void Utils::show_error(int connfd, const char *info) {
     close(connfd);
 }
 
-int *Utils::u_pipefd = 0;
-int Utils::u_epollfd = 0;
-
 class Utils;
 // 定时器回调函数
 void cb_func(client_data *user_data) {
     // 删除非活动连接在socket上的注册事件
-    epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
-    // 关闭文件描述符
-    close(user_data->sockfd);
-    // 减少连接数
-    http_conn::m_user_count--;
-}
\ No newline at end of file
+    int sockfd = user_data->sockfd;
+    user_data->timer = NULL;
+    // 连接正由工作线程处理: 只关闭读写，由事件循环在连接交还时关闭并回收
+    http_conn *conn = conn_slab::get_instance()->find(sockfd);
+    if (conn && conn->m_busy) {
+        shutdown(sockfd, SHUT_RDWR);
+        return;
+    }
+    epoll_ctl(user_data->epollfd, EPOLL_CTL_DEL, sockfd, 0);
+    // 回收连接对象后再关闭文件描述符: 关闭后fd可能立即被其他reactor接收的新连接复用
+    conn_slab::get_instance()->put(sockfd);
+    close(sockfd);
+}
+// io_uring模式的定时器回调: 连接上可能还有进行中的recv/send，不能直接关闭fd，
+// 这里只关闭读写使进行中的操作尽快完成，由ring线程在完成事件中关闭fd并回收资源
+void shutdown_cb_func(client_data *user_data) {
+    assert(user_data);
+    user_data->timer = NULL;
+    shutdown(user_data->sockfd, SHUT_RDWR);
+}
@@ -22,62 +22,116 @@
 #include <sys/uio.h>
 
 #include <time.h>
+#include <sys/timerfd.h>
 #include "../log/log.h"
+#include "cached_clock.h"
 
 /*
     项目中将连接资源、定时事件和超时时间封装为定时器类，具体的：
     * 连接资源包括客户端套接字地址、文件描述符和定时器
     * 定时事件为回调函数，将其封装起来由用户自定义，这里是删除非活动socket上的注册事件，并关闭
-    * 定时器超时时间 = 浏览器和服务器连接时刻 + 固定时间(TIMESLOT)，可以看出，
-      定时器使用绝对时间作为超时值，这里alarm设置为5秒，连接超时为15秒
+    * 定时器超时时间 = 最近一次活动时刻 + 连接超时时间，使用CLOCK_MONOTONIC的毫秒绝对时间，
+      每个reactor有一个timerfd，按时间轮中最早需要处理的时刻设置，到期时在事件循环中处理，连接超时为15秒
 */
 
-//前向声明: 连接资源结构体成员需要用到定时器类; 
-class util_timer;
+//前向声明: 定时器回调的参数是连接资源
+struct client_data;
 
-// 连接资源
-struct client_data
+// 连接所处的阶段，各阶段按各自的规则计算超时时间，到期时按阶段分别计数
+enum TIMER_PHASE
 {
-    sockaddr_in address; // 客户端socket地址
-    int sockfd;          // socket文件描述符
-    util_timer *timer;   // 定时器
+    PHASE_HEADER = 0,   // 接收请求行和请求头: 从新连接建立或请求的第一个字节起计时，收到数据不延长
+    PHASE_BODY,         // 接收消息体: 从请求头结束起计时，每收到body_rate字节延长1秒
+    PHASE_WRITE,        // 发送响应: 每次发送有进展时重新计时
+    PHASE_KEEPALIVE,    // 长连接等待下一个请求: 上一个响应发完时起计时
+    PHASE_NUM
 };
 
-// 定时器类
+// 各阶段的超时时间(毫秒)
+struct timer_deadlines
+{
+    int header;
+    int body;
+    int body_rate;      // 消息体的最低接收速率(字节/秒)，0为不按速率延长
+    int write;
+    int keepalive;
+};
+
+// 定时器类: 侵入式结点，嵌入在连接资源中随http_conn对象分配和复用，不再为每个连接new一个定时器
 class util_timer
 {
 public:
     util_timer() : prev(NULL), next(NULL) {}
 
 public:
-    time_t expire;                      // 超时时间
+    long long expire;                   // 超时时间(单调时钟毫秒)
     void (* cb_func)(client_data *);    // 回调函数
     client_data *user_data;             // 连接资源
-    util_timer *prev;                   // 前向定时器
-    util_timer *next;                   // 后继定时器
+    util_timer *prev;                   // 所在槽位链表中的前向结点，不在时间轮中时为NULL
+    util_timer *next;                   // 所在槽位链表中的后继结点
+    int phase;                          // 连接所处的阶段
+    unsigned seq;                       // 阶段序号，同一阶段中序号改变(如流水线中的下一个请求)也重新计时
+    long long start;                    // 当前阶段的开始时间
+};
+
+// 连接资源
+struct client_data
+{
+    sockaddr_in address; // 客户端socket地址
+    int sockfd;          // socket文件描述符
+    int epollfd;         // 所属reactor的epoll实例
+    int loop;            // 所属reactor编号
+    util_timer *timer;   // 定时器，指向node，连接关闭后为NULL
+    util_timer node;     // 定时器结点
 };
 
-// **定时器容器**为带头尾结点的升序双向链表，具体的为每个连接创建一个定时器，
-// 将其添加到链表中，并按照超时时间升序排列。执行定时任务时，将到期的定时器从链表中删除。
-// 主要涉及双向链表的插入，删除操作，其中添加定时器的事件复杂度是O(n),删除定时器的事件复杂度是O(1)
-class sort_timer_lst
+// **定时器容器**为分层时间轮，精度1毫秒: 第一层256个槽位，每个槽位对应1毫秒；
+// 其上三层各64个槽位，每个槽位分别对应256毫秒、约16秒和约17分钟，最远约18.6小时，更远的按最远处理。
+// 定时器按超时时间与当前时刻之差放入对应层的槽位，时间走过上层一个槽位对应的时段时，
+// 把该槽位中的定时器重新分配到下层(级联)。每个槽位是带哨兵结点的循环双向链表，
+// 添加、调整和删除定时器都是O(1)，tick按毫秒推进，一次取走一个槽位中全部到期的定时器
+class time_wheel
 {
 public:
-    sort_timer_lst();
-    ~sort_timer_lst();
+    time_wheel();
+    explicit time_wheel(long long now);     // 从给定时刻开始计时
 
     void add_timer(util_timer *timer);
-    void adjust_timer(util_timer *timer);
-    void del_timer(util_timer *timer);
+    void adjust_timer(util_timer *timer);   // 超时时间改变后移到新的槽位
+    void del_timer(util_timer *timer);      // 从时间轮中摘除，结点内存属于连接资源，不释放
     void tick(); // 定时任务处理函数
+    void tick(long long cur);               // 推进到给定时刻
+    // 下一个需要处理的时刻: 第一个非空的槽位或第一次会级联出定时器的时刻，不早于最早的超时时间，
+    // 时间轮为空时返回-1
+    long long next_expire() const;
+    // 各阶段到期关闭的连接数
+    unsigned long long expired(int phase) const { return m_expired[phase]; }
 
 private:
-    //私有成员，被公有成员add_timer和adjust_time调用, 主要用于调整链表内部结点
-    void add_timer(util_timer *timer, util_timer *lst_head);
-    
-    // 头尾结点
-    util_timer *head;
-    util_timer *tail;
+    static const int ROOT_BITS = 8;
+    static const int ROOT_SIZE = 1 << ROOT_BITS;
+    static const int ROOT_MASK = ROOT_SIZE - 1;
+    static const int LEVEL_BITS = 6;
+    static const int LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const int LEVEL_MASK = LEVEL_SIZE - 1;
+    static const int LEVELS = 3;
+    static const long long MAX_SPAN = 1LL << (ROOT_BITS + LEVELS * LEVEL_BITS);
+
+    void init(long long now);
+    // 按超时时间放入槽位
+    void insert(util_timer *timer);
+    // 从所在槽位链表中摘除
+    static void unlink(util_timer *timer);
+    // 把上层一个槽位中的定时器重新分配到下层
+    void cascade(util_timer *slot);
+    // 时间走到t时是否有上层槽位需要级联，t为256毫秒的整数倍
+    bool cascades_at(long long t) const;
+
+    util_timer m_root[ROOT_SIZE];               // 第一层，各槽位为哨兵结点
+    util_timer m_levels[LEVELS][LEVEL_SIZE];    // 上层
+    long long m_now;                            // 下一个要处理的毫秒
+    int m_count;                                // 时间轮中的定时器数
+    unsigned long long m_expired[PHASE_NUM];
 };
 
 class Utils
@@ -86,7 +140,11 @@ public:
     Utils() {}
     ~Utils() {}
 
-    void init(int timeslot);
+    // timerfd由调用者创建，epoll模式下为非阻塞; interval为两次到期的最长间隔(毫秒)
+    void init(int timerfd, int interval);
+
+    // CLOCK_MONOTONIC的当前时间(毫秒)，不受系统时间调整影响，取自事件循环本轮更新的缓存时钟
+    static long long now_ms();
 
     //对文件描述符设置非阻塞
     int setnonblocking(int fd);
@@ -94,24 +152,35 @@ public:
     //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
     void addfd(int epollfd, int fd, bool one_shot, int TRIGMode);
 
-    //信号处理函数
-    static void sig_handler(int sig);
-
     //设置信号函数
     void addsig(int sig, void(handler)(int), bool restart = true);
 
-    //定时处理任务，重新定时以不断触发SIGALRM信号
+    //按时间轮中下一个需要处理的时刻设置timerfd，最晚不超过interval之后，已设置的时间不晚于它时不重复设置
+    void arm_timer();
+    //定时器的超时时间为expire，早于timerfd当前的到期时间时才重新设置
+    void arm_timer(long long expire) {
+        if (0 == m_armed || expire < m_armed)
+            arm_timer();
+    }
+
+    //按连接所处的阶段计算定时器的超时时间并记录阶段，阶段或序号改变时从现在开始计时，
+    //body_bytes为已收到的消息体字节数
+    long long deadline(util_timer *timer, int phase, unsigned seq, long long body_bytes);
+
+    //定时处理任务: timerfd到期后处理到期的定时器，并按时间轮重新设置timerfd
     void timer_handler();
 
     void show_error(int connfd, const char *info);
 
 public:
-    static int *u_pipefd;
-    sort_timer_lst m_timer_lst; //创建定时器容器链表
-    static int u_epollfd;
-    int m_TIMESLOT;
+    time_wheel m_timer_wheel;   //定时器容器时间轮
+    timer_deadlines m_deadlines;    //各阶段的超时时间
+    int m_timerfd;
+    int m_interval;             //timerfd最长到期间隔，保证没有定时器时周期性任务也能执行
+    long long m_armed;          //timerfd当前设置的到期时间，0表示未设置
 };
 
 void cb_func(client_data *user_data);
+void shutdown_cb_func(client_data *user_data);
 
 #endif
@@ -0,0 +1,235 @@
+#include "uring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+// 内核与用户态共享的队列指针需要用acquire/release语义读写
+#define URING_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define URING_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+uring::uring() : m_ring_fd(-1),
+                 m_sqes(NULL),
+                 m_sqe_tail(0),
+                 m_sqe_head(0),
+                 m_sq_ptr(MAP_FAILED),
+                 m_cq_ptr(MAP_FAILED),
+                 m_buf_ring(NULL),
+                 m_bufs(NULL),
+                 m_buf_entries(0),
+                 m_buf_size(0),
+                 m_buf_tail(0) {
+}
+
+uring::~uring() {
+    if (m_sqes)
+        munmap(m_sqes, m_sq_entries * sizeof(struct io_uring_sqe));
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+        munmap(m_cq_ptr, m_cq_ring_sz);
+    if (m_sq_ptr != MAP_FAILED)
+        munmap(m_sq_ptr, m_sq_ring_sz);
+    if (m_ring_fd >= 0)
+        close(m_ring_fd);
+    free(m_buf_ring);
+    free(m_bufs);
+}
+
+bool uring::init(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (m_ring_fd < 0)
+        return false;
+
+    // 5.4之后SQ与CQ可以用一次mmap映射
+    m_sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        if (m_cq_ring_sz > m_sq_ring_sz)
+            m_sq_ring_sz = m_cq_ring_sz;
+        m_cq_ring_sz = m_sq_ring_sz;
+    }
+
+    m_sq_ptr = mmap(0, m_sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+        return false;
+    if (single_mmap) {
+        m_cq_ptr = m_sq_ptr;
+    } else {
+        m_cq_ptr = mmap(0, m_cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        m_ring_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED)
+            return false;
+    }
+
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sq_entries = p.sq_entries;
+    m_sqe_head = m_sqe_tail = *m_sq_tail;
+
+    void *sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return false;
+    m_sqes = (struct io_uring_sqe *)sqes;
+
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
+}
+
+// entries必须是2的幂，缓冲区ring需要按页对齐
+bool uring::setup_buf_ring(int bgid, unsigned entries, unsigned buf_size) {
+    size_t ring_sz = entries * sizeof(struct io_uring_buf);
+    if (posix_memalign((void **)&m_buf_ring, sysconf(_SC_PAGESIZE), ring_sz) != 0)
+        return false;
+    memset(m_buf_ring, 0, ring_sz);
+    m_bufs = (char *)malloc((size_t)entries * buf_size);
+    if (!m_bufs)
+        return false;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)m_buf_ring;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return false;
+
+    m_buf_entries = entries;
+    m_buf_size = buf_size;
+    m_buf_tail = 0;
+    for (unsigned i = 0; i < entries; ++i)
+        recycle_buf(i);
+    return true;
+}
+
+void uring::recycle_buf(int bid) {
+    // C++下内核头文件中的柔性数组bufs会多出一个空结构体的偏移，这里直接按数组访问
+    struct io_uring_buf *bufs = (struct io_uring_buf *)m_buf_ring;
+    struct io_uring_buf *buf = &bufs[m_buf_tail & (m_buf_entries - 1)];
+    buf->addr = (unsigned long)buf_addr(bid);
+    buf->len = m_buf_size;
+    buf->bid = bid;
+    ++m_buf_tail;
+    URING_STORE_RELEASE(&m_buf_ring->tail, m_buf_tail);
+}
+
+struct io_uring_sqe *uring::get_sqe() {
+    unsigned head = URING_LOAD_ACQUIRE(m_sq_head);
+    if (m_sqe_tail - head >= m_sq_entries) {
+        submit_and_wait(0);
+        head = URING_LOAD_ACQUIRE(m_sq_head);
+        if (m_sqe_tail - head >= m_sq_entries)
+            return NULL;
+    }
+    unsigned idx = m_sqe_tail & *m_sq_mask;
+    struct io_uring_sqe *sqe = &m_sqes[idx];
+    m_sq_array[idx] = idx;
+    ++m_sqe_tail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring::submit_and_wait(unsigned wait_nr) {
+    unsigned to_submit = m_sqe_tail - m_sqe_head;
+    if (to_submit)
+        URING_STORE_RELEASE(m_sq_tail, m_sqe_tail);
+    m_sqe_head = m_sqe_tail;
+    if (!to_submit && !wait_nr)
+        return 0;
+    int ret = syscall(__NR_io_uring_enter, m_ring_fd, to_submit, wait_nr,
+                      wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    return ret < 0 ? -errno : ret;
+}
+
+struct io_uring_cqe *uring::peek_cqe() {
+    unsigned head = *m_cq_head;
+    if (head == URING_LOAD_ACQUIRE(m_cq_tail))
+        return NULL;
+    return &m_cqes[head & *m_cq_mask];
+}
+
+void uring::cqe_seen() {
+    URING_STORE_RELEASE(m_cq_head, *m_cq_head + 1);
+}
+
+// 一次提交持续接收新连接，每个连接产生一个cqe，IORING_CQE_F_MORE消失时需重新提交
+bool uring::prep_accept_multishot(int fd, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+    return true;
+}
+
+// 由内核从bgid组中挑选接收缓冲区，cqe->flags高16位为缓冲区编号
+bool uring::prep_recv(int fd, int bgid, unsigned len, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->len = len;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bgid;
+    sqe->user_data = user_data;
+    return true;
+}
+
+// link为true时与下一个sqe链接，前一个完成后才开始下一个
+bool uring::prep_send(int fd, const void *buf, unsigned len, int msg_flags, bool link, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->msg_flags = msg_flags;
+    if (link)
+        sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool uring::prep_writev(int fd, const struct iovec *iov, int count, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)iov;
+    sqe->len = count;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool uring::prep_read(int fd, void *buf, unsigned len, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = user_data;
+    return true;
+}
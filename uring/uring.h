@@ -0,0 +1,75 @@
+#ifndef URING_H
+#define URING_H
+/*
+    io_uring封装类: 直接使用io_uring_setup/io_uring_enter/io_uring_register系统调用，不依赖liburing.
+    > * 提交队列(SQ)与完成队列(CQ)通过mmap与内核共享
+    > * provided buffer ring: 预先把一组接收缓冲区交给内核，recv完成时由内核挑选缓冲区
+    > * 常用操作(accept/recv/send/writev/read)的sqe填充函数
+*/
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <stdint.h>
+
+class uring {
+public:
+    uring();
+    ~uring();
+
+    // 创建ring并完成SQ/CQ/SQE的映射，entries为提交队列长度
+    bool init(unsigned entries);
+
+    // 注册provided buffer ring: 共entries个缓冲区，每个buf_size字节，组号为bgid
+    bool setup_buf_ring(int bgid, unsigned entries, unsigned buf_size);
+    // 由缓冲区编号取得缓冲区地址
+    char *buf_addr(int bid) { return m_bufs + (size_t)bid * m_buf_size; }
+    // 数据取走后将缓冲区归还给内核
+    void recycle_buf(int bid);
+
+    // 取一个空闲sqe，提交队列已满时先提交已有的sqe
+    struct io_uring_sqe *get_sqe();
+    // 提交所有sqe，并至少等待wait_nr个完成事件
+    int submit_and_wait(unsigned wait_nr);
+    // 取出一个完成事件，没有则返回NULL；处理完需调用cqe_seen
+    struct io_uring_cqe *peek_cqe();
+    void cqe_seen();
+
+    // 以下函数填充一个sqe，提交队列无法腾出空间时返回false
+    bool prep_accept_multishot(int fd, uint64_t user_data);
+    bool prep_recv(int fd, int bgid, unsigned len, uint64_t user_data);
+    bool prep_send(int fd, const void *buf, unsigned len, int msg_flags, bool link, uint64_t user_data);
+    bool prep_writev(int fd, const struct iovec *iov, int count, uint64_t user_data);
+    bool prep_read(int fd, void *buf, unsigned len, uint64_t user_data);
+
+private:
+    int m_ring_fd;
+
+    // 提交队列
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    struct io_uring_sqe *m_sqes;
+    unsigned m_sq_entries;
+    unsigned m_sqe_tail;        // 本地已填充但未提交的sqe尾部
+    unsigned m_sqe_head;        // 本地已提交的sqe位置
+
+    // 完成队列
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    void *m_sq_ptr;
+    void *m_cq_ptr;
+    size_t m_sq_ring_sz;
+    size_t m_cq_ring_sz;
+
+    // provided buffer ring
+    struct io_uring_buf_ring *m_buf_ring;
+    char *m_bufs;
+    unsigned m_buf_entries;
+    unsigned m_buf_size;
+    unsigned short m_buf_tail;
+};
+
+#endif
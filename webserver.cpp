@@ -1,4 +1,20 @@
 #include "webserver.h"
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+// io_uring请求类型，编码在user_data的低8位，高位为连接的fd
+enum URING_OP {
+    URING_ACCEPT = 1,
+    URING_RECV,
+    URING_SEND,
+    URING_DONE,
+    URING_SIGNAL,
+    URING_TICK
+};
+
+static inline uint64_t uring_data(int op, int fd) {
+    return ((uint64_t)fd << 8) | op;
+}
 
 /**
  * 服务器接收http请求浏览器端发出http连接请求，主线程创建http对象接收请求并将所有数据读入对应buffer，
@@ -6,30 +22,72 @@
  */
 
 WebServer::WebServer() {
-    // 创建MAX_FD个 http_conn类对象
-    users = new http_conn[MAX_FD];
+    // 将文件描述符软限制提高到硬限制(不超过MAX_FD)，可接受的连接数随之确定
+    struct rlimit rl;
+    m_max_fd = 65536;
+    if (0 == getrlimit(RLIMIT_NOFILE, &rl)) {
+        rlim_t limit = rl.rlim_max < (rlim_t)MAX_FD ? rl.rlim_max : (rlim_t)MAX_FD;
+        if (rl.rlim_cur < limit) {
+            rl.rlim_cur = limit;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+        m_max_fd = rl.rlim_cur < (rlim_t)MAX_FD ? rl.rlim_cur : MAX_FD;
+    }
+
+    // http_conn对象在连接建立时才从对象池中分配，空闲对象超过2个统计周期未被复用则释放
+    users = conn_slab::get_instance();
+    users->init(m_max_fd, SLAB_MIN_FREE, 2 * TIMESLOT);
 
     //root文件夹路径
     char server_path[200];
     getcwd(server_path, 200);
-    LOG_INFO("Current  work path  %s", "server_path");
     char root[6] = "/root";
     m_root = (char *)malloc(strlen(server_path) + strlen(root) + 1);
     strcpy(m_root, server_path);
     strcat(m_root, root);
 
-    // 创建连接资源数组
-    users_timer = new client_data[MAX_FD];
+    m_reactors = NULL;
+    m_pool = NULL;
+    m_db_pool = NULL;
+    m_reactor_num = 1;
+    m_stop_server = false;
+    m_signalfd = -1;
+
+    // SIGTERM和SIGHUP改由signalfd接收，必须在创建日志、线程池等线程之前屏蔽，
+    // 之后创建的线程都继承该屏蔽字，信号不会打断任何线程的系统调用
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
 }
 
 WebServer::~WebServer() {
-    close(m_epollfd);
-    close(m_listenfd);
-    close(m_pipefd[1]);
-    close(m_pipefd[0]);
-    delete[] users;
-    delete[] users_timer;
+    //先回收工作线程，它们处理完手头的任务后仍会访问reactor的完成队列;
+    //静态文件线程池可能向数据库线程池转交任务，先回收。
+    //日志不再向线程池放入任务，队列中未执行的写日志任务随线程池析构时写入
+    Log::get_instance()->set_executor(NULL);
     delete m_pool;
+    delete m_db_pool;
+    for (int i = 0; m_reactors && i < m_reactor_num; ++i) {
+        reactor *r = &m_reactors[i];
+        if (r->epollfd >= 0)
+            close(r->epollfd);
+        close(r->listenfd);
+        if (r->idlefd >= 0)
+            close(r->idlefd);
+        if (r->eventfd >= 0)
+            close(r->eventfd);
+        if (r->utils.m_timerfd >= 0)
+            close(r->utils.m_timerfd);
+        delete r->ring;
+        delete[] r->send_inflight;
+        delete[] r->send_bytes;
+        delete[] r->send_error;
+    }
+    if (m_signalfd >= 0)
+        close(m_signalfd);
+    delete[] m_reactors;
 }
 
 void WebServer::init(int port,
@@ -42,19 +100,59 @@ void WebServer::init(int port,
                      int sql_num,
                      int thread_num,
                      int close_log,
-                     int actor_model)
+                     int actor_model,
+                     int reactor_num,
+                     int backlog,
+                     int accept_budget,
+                     int defer_accept,
+                     int fastopen,
+                     int send_mode,
+                     int header_limit,
+                     int body_limit,
+                     int keepalive_timeout,
+                     int max_requests,
+                     int idle_high_water,
+                     int header_timeout,
+                     int body_timeout,
+                     int body_rate,
+                     int write_timeout,
+                     int sched,
+                     int thread_max)
 {
     m_port = port;
     m_user = user;
     m_passWord = passWord;
     m_databaseName = databaseName;
     m_sql_num = sql_num;
-    m_thread_num = thread_num;
+    //未指定时最小线程数取进程可用的CPU数(考虑cgroup配额)，最大线程数为其4倍，
+    //多出的线程用于等待数据库等阻塞操作
+    m_thread_num = thread_num > 0 ? thread_num : effective_cpus();
+    m_thread_max = thread_max > 0 ? thread_max : m_thread_num * 4;
     m_log_write = log_write;
     m_OPT_LINGER = opt_linger;
     m_TRIGMode = trigmode;
     m_close_log = close_log;
     m_actormodel = actor_model;
+    m_reactor_num = reactor_num > 0 ? reactor_num : 1;
+    m_backlog = backlog > 0 ? backlog : SOMAXCONN;
+    m_accept_budget = accept_budget > 0 ? accept_budget : 1;
+    m_defer_accept = defer_accept;
+    m_fastopen = fastopen;
+    //io_uring没有sendfile操作，该模式下仍由ring以send/writev发送mmap的文件
+    m_send_mode = (2 == actor_model) ? 0 : send_mode;
+    //请求头和消息体的大小上限对所有连接相同
+    if (header_limit > 0)
+        http_conn::m_header_limit = header_limit;
+    if (body_limit >= 0)
+        http_conn::m_body_limit = body_limit;
+    m_deadlines.header = header_timeout > 0 ? header_timeout * 1000 : CONN_TIMEOUT;
+    m_deadlines.body = body_timeout > 0 ? body_timeout * 1000 : CONN_TIMEOUT;
+    m_deadlines.body_rate = body_rate > 0 ? body_rate : 0;
+    m_deadlines.write = write_timeout > 0 ? write_timeout * 1000 : CONN_TIMEOUT;
+    m_deadlines.keepalive = keepalive_timeout > 0 ? keepalive_timeout * 1000 : CONN_TIMEOUT;
+    m_sched = (sched >= SCHED_SHARED && sched <= SCHED_AFFINITY) ? sched : SCHED_SHARED;
+    http_conn::m_max_requests = max_requests > 0 ? max_requests : 0;
+    m_idle_high_water = idle_high_water > 0 ? idle_high_water : m_max_fd / 10 * 9;
 }
 
 void WebServer::trig_mode() {
@@ -87,6 +185,8 @@ void WebServer::log_write() {
             Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800);
         else
             Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0);
+
+        LOG_INFO("Current  work path  %s", m_root);
     }
 }
 
@@ -97,26 +197,39 @@ void WebServer::sql_pool() {
     // m_connPool->init("127.0.0.1", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
 
     //初始化数据库读取表
-    users->initmysql_result(m_connPool);
+    //连接对象尚未分配，用临时对象读取，结果存放在全局的用户表中
+    http_conn conn;
+    conn.initmysql_result(m_connPool);
 }
 
 void WebServer::thread_pool() {
     //线程池
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    //静态文件线程池不取数据库连接，登录、注册等请求解析后转交数据库线程池，
+    //后者的线程数与数据库连接数相同，只做请求处理，收发仍由事件循环或静态文件线程池完成
+    m_pool = new threadpool<http_conn>(m_actormodel, NULL, m_thread_num, 10000, m_sched, m_thread_max);
+    m_db_pool = new threadpool<http_conn>(0, m_connPool, m_sql_num, 10000);
+    m_pool->set_db_pool(m_db_pool);
+    m_db_pool->set_done_callback(worker_done, this);
+    //工作线程处理完请求后，经完成队列把连接交还所属reactor
+    m_pool->set_done_callback(worker_done, this);
+    //异步日志的写入作为低优先级任务在静态文件线程池中执行
+    Log::get_instance()->set_executor(m_pool);
 }
 
-void WebServer::eventListen() {
+// 为一个reactor创建监听socket和epoll实例
+// 多reactor时各监听socket绑定同一端口并开启SO_REUSEPORT，由内核在它们之间分摊新连接
+void WebServer::listen_on(reactor *r) {
     //网络编程基础步骤
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(m_listenfd >= 0);
+    r->listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(r->listenfd >= 0);
 
     //优雅关闭连接
     if (0 == m_OPT_LINGER) {
         struct linger tmp = {0, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(r->listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     } else if (1 == m_OPT_LINGER) {
         struct linger tmp = {1, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(r->listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
 
     int ret = 0;
@@ -127,277 +240,516 @@ void WebServer::eventListen() {
     address.sin_port = htons(m_port);
 
     int flag = 1;
-    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
-    ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
+    setsockopt(r->listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    if (m_reactor_num > 1) {
+        ret = setsockopt(r->listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
+        assert(ret >= 0);
+    }
+    // 数据到达后才唤醒accept，省去一次只有握手没有请求的唤醒
+    if (m_defer_accept > 0)
+        setsockopt(r->listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &m_defer_accept, sizeof(m_defer_accept));
+    // 允许客户端在SYN中携带请求数据
+    if (m_fastopen > 0)
+        setsockopt(r->listenfd, IPPROTO_TCP, TCP_FASTOPEN, &m_fastopen, sizeof(m_fastopen));
+    ret = bind(r->listenfd, (struct sockaddr *)&address, sizeof(address));
     assert(ret >= 0);
-    ret = listen(m_listenfd, 5);
+    ret = listen(r->listenfd, m_backlog);
     assert(ret >= 0);
 
-    utils.init(TIMESLOT);
+    //io_uring模式下由ring完成accept，不创建epoll
+    if (2 == m_actormodel) {
+        r->epollfd = -1;
+        return;
+    }
 
     // epoll创建内核事件表
-    epoll_event events[MAX_EVENT_NUMBER];
-    m_epollfd = epoll_create(5);
-    assert(m_epollfd != -1);
+    r->epollfd = epoll_create(5);
+    assert(r->epollfd != -1);
 
     // 将listenfd放在epoll树上
-    utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode);
-    // 将上述epollfd赋值给http类对象的m_epollfd属性
-    http_conn::m_epollfd = m_epollfd;
+    r->utils.addfd(r->epollfd, r->listenfd, false, m_LISTENTrigmode);
+}
+
+void WebServer::eventListen() {
+    m_reactors = new reactor[m_reactor_num];
+    for (int i = 0; i < m_reactor_num; ++i) {
+        reactor *r = &m_reactors[i];
+        r->id = i;
+        r->server = this;
+        r->next_stats = Utils::now_ms() + TIMESLOT * 1000;
+        r->idlefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        memset(&r->stats, 0, sizeof(r->stats));
+        r->ring = NULL;
+        //io_uring模式下由ring阻塞读取eventfd和timerfd，epoll模式下两者为非阻塞并注册到epoll
+        r->eventfd = eventfd(0, EFD_CLOEXEC | (2 == m_actormodel ? 0 : EFD_NONBLOCK));
+        assert(r->eventfd >= 0);
+        int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | (2 == m_actormodel ? 0 : TFD_NONBLOCK));
+        assert(timerfd >= 0);
+        r->utils.init(timerfd, TIMESLOT * 1000);
+        r->utils.m_deadlines = m_deadlines;
+        r->utils.arm_timer();
+        r->send_inflight = NULL;
+        r->send_bytes = NULL;
+        r->send_error = NULL;
+        listen_on(r);
+        if (r->epollfd >= 0) {
+            r->utils.addfd(r->epollfd, r->eventfd, false, 0);
+            r->utils.addfd(r->epollfd, timerfd, false, 0);
+        }
+    }
+
     /*
         信号通知逻辑:
-        * 创建管道，其中管道写端写入信号值，管道读端通过I/O复用系统监测读事件
-        * 设置信号处理函数SIGALRM（时间到了触发）和SIGTERM（kill会触发，Ctrl+C）
-            * 通过struct sigaction结构体和sigaction函数注册信号捕捉函数
-            * 在结构体的handler参数设置信号处理函数，具体的，从管道写端写入信号的名字
-        * 利用I/O复用系统监听管道读端文件描述符的可读事件
-        * 信息值传递给主循环，主循环再根据接收到的信号值执行目标信号对应的逻辑代码
+        * 构造函数中已屏蔽SIGTERM（kill会触发）和SIGHUP（终端断开），这里用同一信号集创建signalfd
+        * 信号到达时signalfd可读，由0号reactor与其他事件一起处理，读出的signalfd_siginfo中si_signo为信号值
+        * 定时不再依赖SIGALRM，由各reactor的timerfd驱动，信号处理函数与系统调用被打断的问题随之消失
     */
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
-    assert(ret != -1);
-    // 问题1：设置管道写端为非阻塞，为什么写端要非阻塞？
-    //      send是将信息发送给套接字缓冲区，如果缓冲区满了，则会阻塞，
-    //      这时候会进一步增加信号处理函数的执行时间，为此，将其修改为非阻塞。
-    // 问题2：没有对非阻塞返回值处理，如果阻塞是不是意味着这一次定时事件失效了？
-    //      是的，但定时事件是非必须立即处理的事件，可以允许这样的情况发生。
-    utils.setnonblocking(m_pipefd[1]);
-    //设置管道读端为ET非阻塞
-    utils.addfd(m_epollfd, m_pipefd[0], false, 0);
-
-    //传递给主循环的信号值，这里只关注SIGALRM和SIGTERM
-    utils.addsig(SIGPIPE, SIG_IGN);
-    utils.addsig(SIGALRM, utils.sig_handler, false);
-    utils.addsig(SIGTERM, utils.sig_handler, false);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    m_signalfd = signalfd(-1, &mask, SFD_CLOEXEC | (2 == m_actormodel ? 0 : SFD_NONBLOCK));
+    assert(m_signalfd >= 0);
+    //io_uring模式下由ring读取signalfd
+    if (2 != m_actormodel)
+        utils.addfd(m_reactors[0].epollfd, m_signalfd, false, 0);
 
-    //每隔TIMESLOT时间触发SIGALRM信号
-    alarm(TIMESLOT);
-
-    //工具类,信号和描述符基础操作
-    Utils::u_pipefd = m_pipefd;
-    Utils::u_epollfd = m_epollfd;
+    utils.addsig(SIGPIPE, SIG_IGN);
 }
 
-void WebServer::timer(int connfd, struct sockaddr_in client_address) {
-    users[connfd].init( connfd,
+void WebServer::timer(reactor *r, int connfd, struct sockaddr_in client_address) {
+    http_conn *conn = users->get(connfd);
+    conn->init(connfd,
+                        r->epollfd,
                         client_address,
                         m_root,
                         m_CONNTrigmode,
                         m_close_log,
+                        m_send_mode,
+                        0 == m_CONNTrigmode && 1 == m_actormodel,
                         m_user,
                         m_passWord,
                         m_databaseName);
 
     //初始化client_data数据
-    //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
-    users_timer[connfd].address = client_address;
-    users_timer[connfd].sockfd = connfd;
-    util_timer *timer = new util_timer;
-    timer->user_data = &users_timer[connfd];
-    timer->cb_func = cb_func;
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
-    users_timer[connfd].timer = timer;
-    utils.m_timer_lst.add_timer(timer);
-}
-
-// 若有数据传输，则将定时器往后延迟3个单位
-// 并对新的定时器在链表上的位置进行调整
-void WebServer::adjust_timer(util_timer *timer)
+    //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到时间轮中
+    client_data *user_data = &conn->timer_data;
+    user_data->address = client_address;
+    user_data->sockfd = connfd;
+    user_data->epollfd = r->epollfd;
+    user_data->loop = r->id;
+    util_timer *timer = &user_data->node;
+    timer->user_data = user_data;
+    timer->cb_func = (2 == m_actormodel) ? shutdown_cb_func : cb_func;
+    //新连接从接收请求头阶段开始计时
+    timer->phase = PHASE_NUM;
+    timer->expire = r->utils.deadline(timer, PHASE_HEADER, 0, 0);
+    user_data->timer = timer;
+    r->utils.m_timer_wheel.add_timer(timer);
+    r->utils.arm_timer(timer->expire);
+}
+
+// 若有数据传输，则按连接所处的阶段重新计算超时时间，并把定时器移到时间轮中新的槽位:
+// 有未发完的响应为发送阶段，响应已发完且没有未处理的请求数据为长连接空闲阶段，
+// 请求头已解析完为接收消息体阶段，其余为接收请求头阶段
+void WebServer::adjust_timer(reactor *r, util_timer *timer, http_conn *conn)
 {
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
-    utils.m_timer_lst.adjust_timer(timer);
+    bool idle = conn->is_idle();
+    int phase;
+    if (conn->pending_bytes() > 0)
+        phase = PHASE_WRITE;
+    else if (idle)
+        phase = PHASE_KEEPALIVE;
+    else if (conn->in_body())
+        phase = PHASE_BODY;
+    else
+        phase = PHASE_HEADER;
+    timer->expire = r->utils.deadline(timer, phase, conn->requests(), conn->body_received());
+    r->utils.m_timer_wheel.adjust_timer(timer);
+    // 各阶段的超时时间不同，超时时间提前时需要重新设置timerfd
+    r->utils.arm_timer(timer->expire);
+    // 空闲的长连接移到LRU链表尾部，有请求在处理的连接从链表中摘除
+    if (idle)
+        r->idle.touch(conn);
+    else
+        r->idle.remove(conn);
 
     LOG_INFO("%s", "adjust timer once");
 }
 
-void WebServer::deal_timer(util_timer *timer, int sockfd) {
-    timer->cb_func(&users_timer[sockfd]);
-    if (timer) {
-        utils.m_timer_lst.del_timer(timer);
-    }
+void WebServer::deal_timer(reactor *r, util_timer *timer, http_conn *conn) {
+    //同一批事件中连接可能已被完成队列关闭，此时定时器已删除，直接忽略
+    if (!timer)
+        return;
+    //定时器嵌在连接对象中，先从时间轮摘下再回收: 回收后对象可能立即被其他reactor取走并重新挂入它的时间轮
+    int sockfd = conn->get_fd();
+    r->utils.m_timer_wheel.del_timer(timer);
+    timer->cb_func(&conn->timer_data);
 
-    LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
+    LOG_INFO("close fd %d", sockfd);
 }
 
-bool WebServer::dealclinetdata() {
+// 接收新连接: accept4直接得到非阻塞、close-on-exec的socket，省去addfd中的fcntl
+// LT和ET模式下每次唤醒都最多接收m_accept_budget个连接，避免连接风暴时长时间占用事件循环
+bool WebServer::dealclinetdata(reactor *r) {
     struct sockaddr_in client_address;
-    socklen_t client_addrlength = sizeof(client_address);
-    if (0 == m_LISTENTrigmode) {
-        int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+    socklen_t client_addrlength;
+    for (int i = 0; i < m_accept_budget; ++i) {
+        client_addrlength = sizeof(client_address);
+        int connfd = accept4(r->listenfd, (struct sockaddr *)&client_address, &client_addrlength,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (connfd < 0) {
+            // 监听队列已取空
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            // 连接在accept前已被对端重置
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // 描述符耗尽，丢弃队首连接，否则LT模式下会不停地被唤醒
+            if (errno == EMFILE || errno == ENFILE) {
+                accept_overflow(r);
+                continue;
+            }
             LOG_ERROR("%s:errno is:%d", "accept error", errno);
             return false;
         }
-        if (http_conn::m_user_count >= MAX_FD) {
+        // 连接数接近上限时关闭最久未活动的空闲长连接，把位置让给新连接
+        if (http_conn::m_user_count >= m_idle_high_water)
+            evict_idle(r, http_conn::m_user_count - m_idle_high_water + 1);
+        if (connfd >= m_max_fd || http_conn::m_user_count >= m_max_fd) {
             utils.show_error(connfd, "Internal server busy");
             LOG_ERROR("%s", "Internal server busy");
-            return false;
+            r->stats.dropped++;
+            continue;
         }
-        timer(connfd, client_address);
-    } else {
-        while (1) {
-            int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
-            if (connfd < 0) {
-                LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                break;
-            }
-            if (http_conn::m_user_count >= MAX_FD) {
-                utils.show_error(connfd, "Internal server busy");
-                LOG_ERROR("%s", "Internal server busy");
-                break;
-            }
-            timer(connfd, client_address);
-        }
-        return false;
+        r->stats.accepted++;
+        timer(r, connfd, client_address);
+    }
+    // 预算用完时队列中可能还有连接，ET模式不会再次通知，需要重新激活监听事件
+    if (1 == m_LISTENTrigmode) {
+        epoll_event event;
+        event.data.u64 = r->listenfd;
+        event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+        epoll_ctl(r->epollfd, EPOLL_CTL_MOD, r->listenfd, &event);
     }
     return true;
 }
 
-bool WebServer::dealwithsignal(bool &timeout, bool &stop_server) {
-    int ret = 0;
-    int sig;
-    char signals[1024];
-    // 从管道读端读出信号值，成功返回字节数，失败返回-1
-    // 正常情况下，这里的ret返回值总是1，只有14和15两个ASCII码对应的字符
-    ret = recv(m_pipefd[0], signals, sizeof(signals), 0);
-    if (ret == -1) {
-        return false;
-    } else if (ret == 0) {
+// 描述符耗尽时先关闭一个空闲长连接，由调用者重新accept；没有空闲连接时
+// 释放预留的空闲fd，接收队首连接后立即关闭，再重新预留
+void WebServer::accept_overflow(reactor *r) {
+    if (evict_idle(r, 1) > 0)
+        return;
+    r->stats.overflowed++;
+    LOG_ERROR("%s", "accept overflow: too many open files");
+    if (r->idlefd < 0)
+        return;
+    close(r->idlefd);
+    int connfd = accept(r->listenfd, NULL, NULL);
+    if (connfd >= 0)
+        close(connfd);
+    r->idlefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+// 从LRU链表头部开始关闭最多count个空闲长连接，返回关闭的个数
+// io_uring模式下定时器回调只关闭读写，fd在进行中的recv完成后关闭
+int WebServer::evict_idle(reactor *r, int count) {
+    int n = 0;
+    while (n < count && r->idle.oldest()) {
+        http_conn *conn = r->idle.oldest();
+        r->idle.remove(conn);
+        deal_timer(r, conn->timer_data.timer, conn);
+        r->stats.evicted++;
+        ++n;
+    }
+    return n;
+}
+
+void WebServer::log_stats(reactor *r) {
+    LOG_INFO("reactor %d accept: accepted %llu, dropped %llu, overflowed %llu, evicted %llu, idle %d",
+             r->id, r->stats.accepted, r->stats.dropped, r->stats.overflowed,
+             r->stats.evicted, r->idle.size());
+    time_wheel &wheel = r->utils.m_timer_wheel;
+    LOG_INFO("reactor %d timeout: header %llu, body %llu, write %llu, keep-alive %llu",
+             r->id, wheel.expired(PHASE_HEADER), wheel.expired(PHASE_BODY),
+             wheel.expired(PHASE_WRITE), wheel.expired(PHASE_KEEPALIVE));
+    LOG_INFO("conn slab: live %d, free %d", users->live(), users->free_count());
+    unsigned long total = http_conn::m_write_total, inl = http_conn::m_write_inline;
+    LOG_INFO("inline write: %lu of %lu responses (%.1f%%)", inl, total, total ? inl * 100.0 / total : 0.0);
+    unsigned long requests = http_conn::m_request_total, reused = http_conn::m_request_reused;
+    LOG_INFO("keep-alive: %lu of %lu requests on reused connections (%.1f%%)",
+             reused, requests, requests ? reused * 100.0 / requests : 0.0);
+    LOG_INFO("thread pool: live %d (min %d, max %d), busy %d, queue wait %.2fms, grown %lu, shrunk %lu",
+             m_pool->live(), m_thread_num, m_thread_max, m_pool->busy(), m_pool->wait_ms(),
+             m_pool->grown(), m_pool->shrunk());
+    LOG_INFO("db pool: threads %d, busy %d, queue wait %.2fms",
+             m_db_pool->live(), m_db_pool->busy(), m_db_pool->wait_ms());
+    //各工作线程的队列深度和窃取次数，共享队列时只有一项
+    for (int i = 0; i < m_pool->queues(); ++i)
+        LOG_INFO("worker %d: queued %lu, stolen %lu", i, (unsigned long)m_pool->depth(i), m_pool->steals(i));
+}
+
+// timerfd到期: 处理到期的定时器，统计信息每TIMESLOT秒最多输出一次
+void WebServer::deal_tick(reactor *r) {
+    r->utils.timer_handler();
+    LOG_INFO("%s", "timer tick");
+
+    long long now = Utils::now_ms();
+    if (now >= r->next_stats) {
+        log_stats(r);
+        r->next_stats = now + TIMESLOT * 1000;
+        //释放长时间未被复用的连接对象，空闲时内存随连接数回落
+        users->trim();
+    }
+}
+
+bool WebServer::dealwithsignal(bool &stop_server) {
+    struct signalfd_siginfo siginfo[8];
+    // 从signalfd读出信号，每个信号对应一个signalfd_siginfo结构，成功返回字节数，失败返回-1
+    int ret = read(m_signalfd, siginfo, sizeof(siginfo));
+    if (ret <= 0) {
         return false;
-    } else {
-        //处理信号值对应的逻辑
-        for (int i = 0; i < ret; ++i) {
-            // signals[i]是字符型, 而SIGALRM与SIGTREM是整型为什么不冲突?
-            // 信号本身是整型数值，管道中传递的是ASCII码表中整型数值对应的字符。
-            // switch的变量一般为字符或整型，当switch的变量为字符时，
-            // case中可以是字符，也可以是字符对应的ASCII码。 
-            switch (signals[i]) {
-                case SIGALRM: 
-                {
-                    timeout = true;
-                    break;
-                }
-                case SIGTERM:
-                {
-                    stop_server = true;
-                    break;
-                }
+    }
+    //处理信号值对应的逻辑，SIGTERM与SIGHUP都使服务器退出
+    for (int i = 0; i < ret / (int)sizeof(siginfo[0]); ++i) {
+        switch (siginfo[i].ssi_signo) {
+            case SIGTERM:
+            case SIGHUP:
+            {
+                stop_server = true;
+                break;
             }
         }
     }
     return true;
 }
 
-void WebServer::dealwithread(int sockfd) {
-    util_timer *timer = users_timer[sockfd].timer;
+void WebServer::dealwithread(reactor *r, http_conn *conn) {
+    util_timer *timer = conn->timer_data.timer;
 
     //reactor
     if (1 == m_actormodel)
     {
-        if (timer)
-        {
-            adjust_timer(timer);
-        }
-
         //若监测到读事件，将该事件放入请求队列
-        m_pool->append(users + sockfd, 0);
+        //读取结果由工作线程经完成队列返回，事件循环不等待，继续处理其他连接
+        submit(r, conn, 0);
+    }
+    else
+    {
+        //proactor
+        if (conn->read_once())
+        {
+            LOG_INFO("deal with the client(%s)", inet_ntoa(conn->get_address()->sin_addr));
 
-        while (true)
+            //若监测到读事件，将该事件放入请求队列，定时器在连接交还时延长
+            submit(r, conn, 0);
+        }
+        else
         {
-            if (1 == users[sockfd].improv)
-            {
-                if (1 == users[sockfd].timer_flag)
-                {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                users[sockfd].improv = 0;
-                break;
-            }
+            deal_timer(r, timer, conn);
         }
     }
+}
+
+void WebServer::dealwithwrite(reactor *r, http_conn *conn)
+{
+    util_timer *timer = conn->timer_data.timer;
+    //reactor
+    if (1 == m_actormodel)
+    {
+        submit(r, conn, 1);
+    }
     else
     {
         //proactor
-        if (users[sockfd].read_once())
+        bool pipelined = false;
+        if (conn->write(pipelined))
         {
-            LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO("send data to the client(%s)", inet_ntoa(conn->get_address()->sin_addr));
 
-            //若监测到读事件，将该事件放入请求队列
-            m_pool->append_p(users + sockfd);
+            //本批已发完，不再关注写事件
+            if (0 == conn->pending_bytes() && EPOLLIN != conn->m_interest)
+                conn->set_interest(EPOLLIN);
+
+            //读缓冲区中还有流水线请求，直接放入请求队列，不必等待新的读事件
+            if (pipelined)
+            {
+                submit(r, conn, 0);
+                return;
+            }
 
             if (timer)
             {
-                adjust_timer(timer);
+                adjust_timer(r, timer, conn);
             }
         }
         else
         {
-            deal_timer(timer, sockfd);
+            deal_timer(r, timer, conn);
         }
     }
 }
 
-void WebServer::dealwithwrite(int sockfd)
+// 连接先在本轮事件循环中收集，epoll模式下同时标记为处理中，本轮事件处理完后由flush_batch一次放入请求队列
+void WebServer::submit(reactor *r, http_conn *conn, int state)
 {
-    util_timer *timer = users_timer[sockfd].timer;
-    //reactor
-    if (1 == m_actormodel)
+    //状态在入队前写入，工作线程出队后可见
+    conn->m_state = state;
+    if (2 != m_actormodel)
+        conn->m_busy = true;
+    r->batch.push_back(conn);
+}
+
+// 一次加锁或一次占用环形队列的槽位放入本轮收集的全部连接，只唤醒与任务数相同的工作线程。
+// 请求队列已满时，放不下的连接与逐个放入时一样关闭
+void WebServer::flush_batch(reactor *r)
+{
+    if (r->batch.empty())
+        return;
+    int n = (int)r->batch.size();
+    int pushed = m_pool->append_batch(&r->batch[0], n);
+    if (pushed < n)
+        LOG_WARN("workqueue reached maxsize, %d connections dropped", n - pushed);
+    for (int i = pushed; i < n; ++i)
     {
-        if (timer)
+        http_conn *conn = r->batch[i];
+        if (2 == m_actormodel)
         {
-            adjust_timer(timer);
+            uring_close(r, conn->get_fd());
+            continue;
         }
+        conn->m_busy = false;
+        deal_timer(r, conn->timer_data.timer, conn);
+    }
+    r->batch.clear();
+}
 
-        m_pool->append(users + sockfd, 1);
+// 工作线程回调: 把处理完的连接交给所属reactor，队列由空变非空时才写eventfd唤醒事件循环，
+// 事件循环每次被唤醒都会取走整个队列
+void WebServer::worker_done(http_conn *request, void *arg)
+{
+    WebServer *server = (WebServer *)arg;
+    reactor *r = &server->m_reactors[request->timer_data.loop];
 
-        while (true)
-        {
-            if (1 == users[sockfd].improv)
-            {
-                if (1 == users[sockfd].timer_flag)
-                {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                users[sockfd].improv = 0;
-                break;
-            }
-        }
+    r->done_lock.lock();
+    bool wake = r->done.empty();
+    r->done.push_back(request->handle());
+    r->done_lock.unlock();
+
+    if (wake)
+    {
+        uint64_t one = 1;
+        ::write(r->eventfd, &one, sizeof(one));
     }
-    else
+}
+
+// 连接归属工作线程期间到达的事件: 记下后在连接交还时处理。LT模式下就绪状态在工作线程
+// 读写之前会被反复报告，同一事件第二次到达时暂停通知，避免事件循环空转
+void WebServer::defer_event(http_conn *conn, int events)
+{
+    if (0 == m_CONNTrigmode && (conn->m_deferred & events) && conn->m_interest)
+        conn->set_interest(0);
+    conn->m_deferred |= events;
+}
+
+// 处理完成队列，连接交还事件循环: 工作线程读写失败、关闭了连接、处理期间定时器到期或对端挂断时
+// 关闭连接；否则根据是否还有未发完的数据关注写事件或读事件，关注的事件不变时不调用epoll_ctl
+void WebServer::dealwithdone(reactor *r)
+{
+    read(r->eventfd, &r->eventfd_val, sizeof(r->eventfd_val));
+
+    std::vector<uint64_t> done;
+    r->done_lock.lock();
+    done.swap(r->done);
+    r->done_lock.unlock();
+
+    for (size_t i = 0; i < done.size(); ++i)
     {
-        //proactor
-        if (users[sockfd].write())
-        {
-            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+        //句柄过期说明连接在此之前已关闭
+        http_conn *conn = http_conn::from_handle(done[i]);
+        if (!conn)
+            continue;
+        conn->m_busy = false;
+        int deferred = conn->m_deferred;
+        conn->m_deferred = 0;
 
-            if (timer)
-            {
-                adjust_timer(timer);
-            }
+        //定时器在工作线程处理期间到期，当时只关闭了读写
+        util_timer *timer = conn->timer_data.timer;
+        if (!timer)
+        {
+            cb_func(&conn->timer_data);
+            continue;
         }
-        else
+        //工作线程读写失败或处理请求时关闭了连接
+        if (1 == conn->timer_flag || conn->is_closed() || (deferred & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
         {
-            deal_timer(timer, sockfd);
+            conn->timer_flag = 0;
+            deal_timer(r, timer, conn);
+            continue;
         }
+        adjust_timer(r, timer, conn);
+
+        //LT模式下未暂停通知时就绪状态会被继续报告；ET模式下修改事件使内核重新检查就绪状态，
+        //补上处理期间到达的事件和因读缓冲区满未读完的数据
+        int ev = conn->pending_bytes() > 0 ? EPOLLOUT : EPOLLIN;
+        if (ev != conn->m_interest || ((deferred || conn->has_unread()) && 1 == m_CONNTrigmode))
+            conn->set_interest(ev);
     }
 }
 
-// 服务器主循环为每一个连接创建一个定时器，并对每个连接进行定时。
-// 另外，利用升序时间链表容器将所有定时器串联起来，若主循环接收到定时通知，则在链表中依次执行定时任务。
+// 子reactor线程处理函数: 运行该reactor自己的事件循环
+void *WebServer::reactor_worker(void *arg) {
+    reactor *r = (reactor *)arg;
+    r->server->loop(r);
+    return r;
+}
+
+// 启动全部reactor: 1..n-1号在各自线程中运行，0号在主线程中运行并负责信号，
+// 0号收到SIGTERM退出后写各子reactor的eventfd唤醒它们，并等待其结束
 void WebServer::eventLoop()
+{
+    for (int i = 1; i < m_reactor_num; ++i) {
+        if (pthread_create(&m_reactors[i].tid, NULL, reactor_worker, &m_reactors[i]) != 0) {
+            LOG_ERROR("%s", "create reactor thread failure");
+            m_reactor_num = i;
+            break;
+        }
+    }
+
+    loop(&m_reactors[0]);
+
+    m_stop_server = true;
+    for (int i = 1; i < m_reactor_num; ++i) {
+        uint64_t one = 1;
+        ::write(m_reactors[i].eventfd, &one, sizeof(one));
+    }
+    for (int i = 1; i < m_reactor_num; ++i) {
+        pthread_join(m_reactors[i].tid, NULL);
+    }
+}
+
+// 服务器主循环为每一个连接创建一个定时器，并对每个连接进行定时。
+// 另外，利用分层时间轮将所有定时器组织起来，timerfd到期时在时间轮中依次执行到期的定时任务。
+// 子reactor的退出由0号reactor写eventfd唤醒后检查退出标志完成。
+void WebServer::loop(reactor *r)
 {
     //超时标志
     bool timeout = false;
     //循环条件
     bool stop_server = false;
 
-    while (!stop_server)
+    if (2 == m_actormodel)
+    {
+        uring_loop(r);
+        return;
+    }
+
+    while (!stop_server && !m_stop_server)
     {
          // 等待所监控文件描述符上有事件的产生
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        int number = epoll_wait(r->epollfd, r->events, MAX_EVENT_NUMBER, -1);
+        //本轮处理事件、定时器和写日志都使用这次读取的时间
+        cached_clock::get_instance()->update();
         if (number < 0 && errno != EINTR)
         {
             LOG_ERROR("%s", "epoll failure");
@@ -406,48 +758,368 @@ void WebServer::eventLoop()
         //轮询文件描述符
         for (int i = 0; i < number; i++)
         {
-            int sockfd = events[i].data.fd;
+            uint64_t data = r->events[i].data.u64;
 
-            //处理新到的客户连接
-            if (sockfd == m_listenfd)
+            //连接上的事件携带句柄，句柄过期说明是同一批事件中已关闭连接的过期事件，直接丢弃
+            if (http_conn::is_handle(data))
             {
-                bool flag = dealclinetdata();
-                if (false == flag)
+                http_conn *conn = http_conn::from_handle(data);
+                if (!conn)
+                    continue;
+                // 连接正由工作线程处理
+                if (conn->m_busy)
+                {
+                    defer_event(conn, r->events[i].events);
                     continue;
+                }
+                // 同一批事件中先处理的完成队列可能已改变连接关注的事件(如响应未发完改为关注写事件)，
+                // 丢弃不再关注的读写事件，避免在响应发完之前开始处理下一批请求
+                uint32_t events = r->events[i].events & (conn->m_interest | EPOLLRDHUP | EPOLLHUP | EPOLLERR);
+                if (!events)
+                    continue;
+                // 连接上有新的事件，不再是可以关闭的空闲连接，处理完交还时再按状态加入LRU链表
+                r->idle.remove(conn);
+                // 以EPOLLONESHOT注册的连接报告事件后，内核已暂停通知
+                if (conn->m_one_shot)
+                    conn->m_interest = 0;
+                // 处理异常事件
+                if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                {
+                    //服务器端关闭连接，移除对应的定时器
+                    deal_timer(r, conn->timer_data.timer, conn);
+                }
+                // 处理客户连接上接收到的数据
+                else if (events & EPOLLIN)
+                {
+                    dealwithread(r, conn);   // 读入对应缓冲区
+                }
+                else if (events & EPOLLOUT)
+                {
+                    dealwithwrite(r, conn);
+                }
+                continue;
             }
-            // 处理异常事件
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+
+            int sockfd = (int)data;
+            //处理新到的客户连接
+            if (sockfd == r->listenfd)
             {
-                //服务器端关闭连接，移除对应的定时器
-                util_timer *timer = users_timer[sockfd].timer;
-                deal_timer(timer, sockfd);
+                bool flag = dealclinetdata(r);
+                if (false == flag)
+                    continue;
             }
-            // 处理信号: 管道读端对应文件描述符发生读事件
-            else if ((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN))
+            // 处理工作线程的完成队列
+            else if (sockfd == r->eventfd)
             {
-                bool flag = dealwithsignal(timeout, stop_server);
-                if (false == flag)
-                    LOG_ERROR("%s", "dealclientdata failure");
+                dealwithdone(r);
             }
-            // 处理客户连接上接收到的数据
-            else if (events[i].events & EPOLLIN)
+            // 定时器到期，读出到期次数
+            else if (sockfd == r->utils.m_timerfd)
             {
-                dealwithread(sockfd);   // 读入对应缓冲区
+                read(sockfd, &r->timer_val, sizeof(r->timer_val));
+                timeout = true;
             }
-            else if (events[i].events & EPOLLOUT)
+            // 处理信号: signalfd发生读事件
+            else if ((0 == r->id) && (sockfd == m_signalfd) && (r->events[i].events & EPOLLIN))
             {
-                dealwithwrite(sockfd);
+                bool flag = dealwithsignal(stop_server);
+                if (false == flag)
+                    LOG_ERROR("%s", "dealwithsignal failure");
             }
         }
-        //处理定时器为非必须事件，收到信号并不是立马处理
+        flush_batch(r);
+        //处理定时器为非必须事件，timerfd到期并不是立马处理
         //完成读写事件后，再进行处理
         if (timeout)
         {
-            utils.timer_handler();
+            deal_tick(r);
+            timeout = false;
+        }
+    }
+}
 
-            LOG_INFO("%s", "timer tick");
+/**
+ * io_uring后端(actor_model == 2)，真正的proactor:
+ * * multishot accept，一次提交持续接收新连接
+ * * recv使用provided buffer，由内核挑选接收缓冲区，收到数据后拷贝到http_conn的读缓冲区并交给线程池
+ * * 工作线程process()完成后经eventfd通知ring线程，响应头和文件内容以两个链接的send发出
+ * * 每个连接同一时刻只有一个进行中的操作(recv、线程池处理或send)，fd只由ring线程关闭
+ */
+void WebServer::uring_loop(reactor *r)
+{
+    bool timeout = false;
+    bool stop_server = false;
 
+    r->send_inflight = new int[m_max_fd];
+    r->send_bytes = new int[m_max_fd];
+    r->send_error = new bool[m_max_fd];
+    r->ring = new uring;
+    if (!r->ring->init(URING_ENTRIES) ||
+        !r->ring->setup_buf_ring(URING_BGID, URING_BUF_NUM, http_conn::READ_BUFFER_SIZE))
+    {
+        LOG_ERROR("%s", "io_uring init failure");
+        return;
+    }
+
+    r->ring->prep_accept_multishot(r->listenfd, uring_data(URING_ACCEPT, 0));
+    r->ring->prep_read(r->eventfd, &r->eventfd_val, sizeof(r->eventfd_val), uring_data(URING_DONE, 0));
+    r->ring->prep_read(r->utils.m_timerfd, &r->timer_val, sizeof(r->timer_val), uring_data(URING_TICK, 0));
+    //0号reactor读取signalfd
+    if (0 == r->id)
+        r->ring->prep_read(m_signalfd, &r->siginfo, sizeof(r->siginfo), uring_data(URING_SIGNAL, 0));
+
+    while (!stop_server && !m_stop_server)
+    {
+        //提交本轮产生的所有请求，并等待至少一个完成事件
+        int ret = r->ring->submit_and_wait(1);
+        cached_clock::get_instance()->update();
+        if (ret < 0 && ret != -EINTR)
+        {
+            LOG_ERROR("%s", "io_uring failure");
+            break;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = r->ring->peek_cqe()) != NULL)
+        {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            r->ring->cqe_seen();
+
+            int sockfd = data >> 8;
+            switch (data & 0xff)
+            {
+            case URING_ACCEPT:
+                uring_accept(r, res, flags);
+                break;
+            case URING_RECV:
+                uring_recv(r, sockfd, res, flags);
+                break;
+            case URING_SEND:
+                uring_send(r, sockfd, res);
+                break;
+            case URING_DONE:
+            {
+                std::vector<uint64_t> done;
+                r->done_lock.lock();
+                done.swap(r->done);
+                r->done_lock.unlock();
+                for (size_t i = 0; i < done.size(); ++i)
+                {
+                    http_conn *conn = http_conn::from_handle(done[i]);
+                    if (conn)
+                        uring_dispatch(r, conn->get_fd());
+                }
+                r->ring->prep_read(r->eventfd, &r->eventfd_val, sizeof(r->eventfd_val), uring_data(URING_DONE, 0));
+                break;
+            }
+            case URING_SIGNAL:
+            {
+                if (res > 0 && (SIGTERM == r->siginfo.ssi_signo || SIGHUP == r->siginfo.ssi_signo))
+                    stop_server = true;
+                r->ring->prep_read(m_signalfd, &r->siginfo, sizeof(r->siginfo), uring_data(URING_SIGNAL, 0));
+                break;
+            }
+            case URING_TICK:
+            {
+                timeout = true;
+                r->ring->prep_read(r->utils.m_timerfd, &r->timer_val, sizeof(r->timer_val), uring_data(URING_TICK, 0));
+                break;
+            }
+            }
+        }
+        flush_batch(r);
+
+        if (timeout)
+        {
+            deal_tick(r);
             timeout = false;
         }
     }
-}
\ No newline at end of file
+}
+
+void WebServer::uring_accept(reactor *r, int res, unsigned flags)
+{
+    //multishot accept被内核终止时需要重新提交
+    if (!(flags & IORING_CQE_F_MORE))
+        r->ring->prep_accept_multishot(r->listenfd, uring_data(URING_ACCEPT, 0));
+
+    if (-EMFILE == res || -ENFILE == res)
+    {
+        accept_overflow(r);
+        return;
+    }
+    if (res < 0)
+    {
+        LOG_ERROR("%s:errno is:%d", "accept error", -res);
+        return;
+    }
+    int connfd = res;
+    if (http_conn::m_user_count >= m_idle_high_water)
+        evict_idle(r, http_conn::m_user_count - m_idle_high_water + 1);
+    if (connfd >= m_max_fd || http_conn::m_user_count >= m_max_fd)
+    {
+        utils.show_error(connfd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+        r->stats.dropped++;
+        return;
+    }
+    r->stats.accepted++;
+
+    //multishot accept不返回对端地址，需要单独获取
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+    getpeername(connfd, (struct sockaddr *)&client_address, &client_addrlength);
+    timer(r, connfd, client_address);
+    uring_post_recv(r, connfd);
+}
+
+void WebServer::uring_recv(reactor *r, int sockfd, int res, unsigned flags)
+{
+    //provided buffer暂时用完，本轮回收后重新提交
+    if (-ENOBUFS == res)
+    {
+        uring_post_recv(r, sockfd);
+        return;
+    }
+    //对端关闭、出错或被定时器shutdown
+    if (res <= 0)
+    {
+        uring_close(r, sockfd);
+        return;
+    }
+
+    int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    http_conn *conn = users->find(sockfd);
+    bool ret = conn->fill_read(r->ring->buf_addr(bid), res);
+    r->ring->recycle_buf(bid);
+    if (!ret)
+    {
+        uring_close(r, sockfd);
+        return;
+    }
+
+    LOG_INFO("deal with the client(%s)", inet_ntoa(conn->get_address()->sin_addr));
+
+    util_timer *timer = conn->timer_data.timer;
+    if (timer)
+        adjust_timer(r, timer, conn);
+
+    submit(r, conn, 0);
+}
+
+// 工作线程处理完请求: 连接已被关闭、响应已生成或请求不完整需继续接收
+void WebServer::uring_dispatch(reactor *r, int sockfd)
+{
+    http_conn *conn = users->find(sockfd);
+    if (conn->is_closed())
+        uring_close(r, sockfd);
+    else if (conn->pending_bytes() > 0)
+        uring_post_send(r, sockfd);
+    else
+        uring_post_recv(r, sockfd);
+}
+
+void WebServer::uring_post_recv(reactor *r, int sockfd)
+{
+    int len = users->find(sockfd)->read_space();
+    if (len > http_conn::READ_BUFFER_SIZE)
+        len = http_conn::READ_BUFFER_SIZE;
+    if (len <= 0 || !r->ring->prep_recv(sockfd, URING_BGID, len, uring_data(URING_RECV, sockfd)))
+        uring_close(r, sockfd);
+}
+
+// 响应头和文件内容分别在两个iovec中时，用两个链接的send发出，头部带MSG_MORE与文件内容合并成尽量少的报文；
+// 其余情况(错误页面或上次未发完的剩余部分)用一个writev发出
+void WebServer::uring_post_send(reactor *r, int sockfd)
+{
+    int count = 0;
+    http_conn *conn = users->find(sockfd);
+    struct iovec *iv = conn->get_iovec(&count);
+    uint64_t data = uring_data(URING_SEND, sockfd);
+    bool ret;
+
+    r->send_bytes[sockfd] = 0;
+    r->send_error[sockfd] = false;
+    if (2 == count && iv[0].iov_len > 0 && iv[1].iov_len > 0)
+    {
+        r->send_inflight[sockfd] = 2;
+        ret = r->ring->prep_send(sockfd, iv[0].iov_base, iv[0].iov_len,
+                                 MSG_MORE | MSG_WAITALL | MSG_NOSIGNAL, true, data) &&
+              r->ring->prep_send(sockfd, iv[1].iov_base, iv[1].iov_len,
+                                 MSG_WAITALL | MSG_NOSIGNAL, false, data);
+    }
+    else
+    {
+        r->send_inflight[sockfd] = 1;
+        ret = r->ring->prep_writev(sockfd, iv, count, data);
+    }
+    if (!ret)
+    {
+        conn->unmap();
+        uring_close(r, sockfd);
+    }
+}
+
+void WebServer::uring_send(reactor *r, int sockfd, int res)
+{
+    //链接的第一个send未全部发出时，第二个会以-ECANCELED完成，按已发送字节数继续发送即可
+    if (res > 0)
+        r->send_bytes[sockfd] += res;
+    else if (res < 0 && -ECANCELED != res)
+        r->send_error[sockfd] = true;
+    if (--r->send_inflight[sockfd] > 0)
+        return;
+
+    http_conn *conn = users->find(sockfd);
+    if (r->send_error[sockfd])
+    {
+        conn->unmap();
+        uring_close(r, sockfd);
+        return;
+    }
+
+    bool linger = conn->is_linger();
+    if (conn->advance(r->send_bytes[sockfd]) > 0)
+    {
+        uring_post_send(r, sockfd);
+        return;
+    }
+    if (!linger)
+    {
+        uring_close(r, sockfd);
+        return;
+    }
+
+    LOG_INFO("send data to the client(%s)", inet_ntoa(conn->get_address()->sin_addr));
+
+    util_timer *timer = conn->timer_data.timer;
+    if (timer)
+        adjust_timer(r, timer, conn);
+    //读缓冲区中还有流水线请求时直接交给线程池，否则继续接收
+    if (conn->is_pipelined())
+    {
+        submit(r, conn, 0);
+        return;
+    }
+    uring_post_recv(r, sockfd);
+}
+
+void WebServer::uring_close(reactor *r, int sockfd)
+{
+    http_conn *conn = users->find(sockfd);
+    util_timer *timer = conn->timer_data.timer;
+    if (timer)
+    {
+        r->utils.m_timer_wheel.del_timer(timer);
+        conn->timer_data.timer = NULL;
+    }
+    //工作线程关闭连接时只关闭了读写，fd在这里关闭
+    if (!conn->is_closed())
+        conn->close_conn();
+    users->put(sockfd);
+    close(sockfd);
+
+    LOG_INFO("close fd %d", sockfd);
+}
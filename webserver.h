@@ -11,13 +11,72 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+#include <atomic>
+#include <vector>
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
+#include "./http/conn_slab.h"
+#include "./uring/uring.h"
 
-const int MAX_FD = 65536;           //最大文件描述符
+const int MAX_FD = 1 << 20;         //最大文件描述符，RLIMIT_NOFILE更小时以其为准
+const int SLAB_MIN_FREE = 1024;     //连接对象池中至少保留的空闲对象数
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
-const int TIMESLOT = 5;             //最小超时单位
+const int TIMESLOT = 5;             //统计信息输出间隔(秒)
+const int CONN_TIMEOUT = 15000;     //各阶段默认的超时时间(毫秒)
+const int URING_ENTRIES = 4096;     //io_uring提交队列长度
+const int URING_BUF_NUM = 1024;     //provided buffer数量，须为2的幂
+const int URING_BGID = 0;           //provided buffer组号
+
+class WebServer;
+
+// 接收连接的统计计数，每个reactor各自累计，定时输出到日志
+struct accept_stats {
+    unsigned long long accepted;    // 成功接收的连接
+    unsigned long long dropped;     // 连接数达到上限而被拒绝的连接
+    unsigned long long overflowed;  // 文件描述符耗尽而被丢弃的连接
+    unsigned long long evicted;     // 为新连接腾出位置而关闭的空闲长连接
+};
+
+// 单个事件循环(reactor)的运行状态
+// 多reactor模式下每个循环独占一个epoll实例、一个监听socket(SO_REUSEPORT)和一个定时器容器，
+// 连接由哪个循环accept，其后的读写与超时处理就全部由该循环负责。
+// 0号reactor运行在主线程上，同时通过signalfd处理信号。
+// actor_model为2时reactor不使用epoll，而是由一个io_uring完成accept、recv和send。
+struct reactor {
+    int id;
+    int epollfd;
+    int listenfd;
+    int idlefd;                             // 预留的空闲fd，描述符耗尽时用于接收并关闭连接
+    accept_stats stats;
+    pthread_t tid;
+    long long next_stats;                   // 下一次输出统计信息的时间(毫秒)
+    WebServer *server;
+    Utils utils;                            // 定时器容器与timerfd
+    conn_lru idle;                          // 本reactor上等待下一个请求的长连接
+    uint64_t timer_val;                     // timerfd到期次数
+    epoll_event events[MAX_EVENT_NUMBER];
+
+    // 完成队列: reactor和io_uring模式下工作线程处理完任务后把连接放回所属reactor，
+    // 再通过eventfd唤醒事件循环，由事件循环完成定时器调整、关闭连接或发送响应
+    int eventfd;
+    uint64_t eventfd_val;
+    locker done_lock;
+    std::vector<uint64_t> done;             // 连接句柄，连接在此期间关闭时句柄过期
+
+    // 本轮事件循环中待交给线程池的连接，处理完本轮事件后一次放入请求队列
+    std::vector<http_conn *> batch;
+
+    // io_uring后端
+    uring *ring;
+    struct signalfd_siginfo siginfo;        // 0号reactor由ring读取的信号
+    int *send_inflight;                     // 每个连接上尚未完成的send数
+    int *send_bytes;                        // 本轮send已发送的字节数
+    bool *send_error;
+};
 
 class WebServer {
 public:
@@ -34,7 +93,24 @@ public:
               int       sql_num,
               int       thread_num,
               int       close_log,
-              int       actor_model);
+              int       actor_model,
+              int       reactor_num,
+              int       backlog,
+              int       accept_budget,
+              int       defer_accept,
+              int       fastopen,
+              int       send_mode,
+              int       header_limit,
+              int       body_limit,
+              int       keepalive_timeout,
+              int       max_requests,
+              int       idle_high_water,
+              int       header_timeout,
+              int       body_timeout,
+              int       body_rate,
+              int       write_timeout,
+              int       sched,
+              int       thread_max);
 
     void thread_pool();
     void sql_pool();
@@ -42,13 +118,39 @@ public:
     void trig_mode();
     void eventListen();
     void eventLoop();
-    void timer(int connfd, struct sockaddr_in client_address);
-    void adjust_timer(util_timer *timer);
-    void deal_timer(util_timer *timer, int sockfd);
-    bool dealclinetdata();
-    bool dealwithsignal(bool& timeout, bool& stop_server);
-    void dealwithread(int sockfd);
-    void dealwithwrite(int sockfd);
+    void timer(reactor *r, int connfd, struct sockaddr_in client_address);
+    void adjust_timer(reactor *r, util_timer *timer, http_conn *conn);
+    void deal_timer(reactor *r, util_timer *timer, http_conn *conn);
+    bool dealclinetdata(reactor *r);
+    bool dealwithsignal(bool& stop_server);
+    void dealwithread(reactor *r, http_conn *conn);
+    void dealwithwrite(reactor *r, http_conn *conn);
+
+private:
+    // 子reactor线程入口，与threadpool::worker相同的静态函数写法
+    static void *reactor_worker(void *arg);
+    void loop(reactor *r);
+    void listen_on(reactor *r);
+    void accept_overflow(reactor *r);
+    int evict_idle(reactor *r, int count);
+    void log_stats(reactor *r);
+    void deal_tick(reactor *r);
+    // 工作线程完成回调与事件循环中的完成队列处理
+    static void worker_done(http_conn *request, void *arg);
+    void defer_event(http_conn *conn, int events);
+    void dealwithdone(reactor *r);
+    void submit(reactor *r, http_conn *conn, int state);
+    void flush_batch(reactor *r);
+
+    // io_uring后端
+    void uring_loop(reactor *r);
+    void uring_accept(reactor *r, int res, unsigned flags);
+    void uring_recv(reactor *r, int sockfd, int res, unsigned flags);
+    void uring_send(reactor *r, int sockfd, int res);
+    void uring_dispatch(reactor *r, int sockfd);
+    void uring_post_recv(reactor *r, int sockfd);
+    void uring_post_send(reactor *r, int sockfd);
+    void uring_close(reactor *r, int sockfd);
 
 public:
     //基础
@@ -58,9 +160,29 @@ public:
     int m_close_log;
     int m_actormodel;
 
-    int m_pipefd[2];
-    int m_epollfd;
-    http_conn *users;
+    int m_signalfd;                 // 接收SIGTERM、SIGHUP，由0号reactor监听
+    int m_max_fd;                   // 可接受的最大fd，由RLIMIT_NOFILE决定
+    conn_slab *users;               // 按fd索引的连接对象池
+
+    //reactor相关
+    reactor *m_reactors;
+    int m_reactor_num;
+    std::atomic<bool> m_stop_server;
+
+    //接收连接相关
+    int m_backlog;
+    int m_accept_budget;
+    int m_defer_accept;
+    int m_fastopen;
+
+    //静态文件发送方式: 0 mmap+writev, 1 sendfile
+    int m_send_mode;
+
+    //接收请求头、接收消息体、发送响应和长连接空闲各阶段的超时时间
+    timer_deadlines m_deadlines;
+
+    //连接数达到该值后，每接收一个新连接就关闭一个最久未活动的空闲长连接
+    int m_idle_high_water;
 
     //数据库相关
     connection_pool *m_connPool;
@@ -70,20 +192,18 @@ public:
     int m_sql_num;
 
     //线程池相关
-    threadpool<http_conn> *m_pool;
-    int m_thread_num;
-
-    //epoll_event相关
-    epoll_event events[MAX_EVENT_NUMBER];
+    threadpool<http_conn> *m_pool;      //静态文件线程池
+    threadpool<http_conn> *m_db_pool;   //数据库线程池
+    int m_thread_num;               //线程池的最小线程数
+    int m_thread_max;               //线程池的最大线程数
+    int m_sched;                    //线程池调度方式: 0共享队列，1工作窃取(轮流分派)，2工作窃取(按连接分派)，3连接亲和
 
-    int m_listenfd;
     int m_OPT_LINGER;
     int m_TRIGMode;
     int m_LISTENTrigmode;
     int m_CONNTrigmode;
 
-    //定时器相关
-    client_data *users_timer;
-    Utils utils;
+    //定时器相关，连接资源client_data保存在http_conn中
+    Utils utils;                    // 描述符基础操作，定时器容器在各reactor中
 };
 #endif
\ No newline at end of file